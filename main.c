@@ -20,20 +20,130 @@
  */
 
 #include <stdio.h>	/* printf(), etc. */
+#include <stdlib.h>	/* atoi() */
+#include <string.h>	/* strcspn() */
+#include <stdarg.h>	/* report() takes printf() arguments */
+#include <time.h>	/* clock_gettime(), for timing self-play */
+#include <pthread.h>	/* parallel search */
+#include <stdatomic.h>	/* handing out root moves to search threads */
 #include <stdbool.h>	/* use bool type instead of mocking it with int */
+#include <stdint.h>	/* fixed-width bitboard masks */
 #include <assert.h>	/* preemptive debugging */
+#include <math.h>	/* sqrt(), for the spread of benchmark times */
+#include <ctype.h>	/* isdigit(), for the requests of -u */
+#include <limits.h>	/* LONG_MAX */
 #include <termios.h>	/* set terminal to 1-character-at-a-time input */
+#include <unistd.h>	/* getopt() */
+#include <fcntl.h>	/* open(), for the solution file */
+#include <sys/mman.h>	/* mmap() of the solution file */
+#include <sys/stat.h>	/* fstat() of the solution file */
+#include <errno.h>	/* EAGAIN, for the sessions of -x */
+#include <sys/socket.h>	/* the socket of -x */
+#include <sys/un.h>	/* struct sockaddr_un */
+#include <sys/epoll.h>	/* waiting for all sessions at once */
+#include <sys/eventfd.h>	/* waking up the event loop from the workers */
 
 #define MAX(X,Y) (X > Y ? X : Y)
 #define MIN(X,Y) (X > Y ? Y : X)
 
 /*
- * Total number of possible moves; highest is 9 (empty board); lowest is 0 (all
- * squares taken).
+ * The board has BOARD_M rows and BOARD_N columns, and a player wins by getting
+ * BOARD_K pieces in a row, across, down or diagonally (see the Makefile). Plain
+ * tic-tac-toe is the 3,3,3 game, which has hand-written tables below; the tables
+ * of any other board are filled in by board_tables() at startup.
  */
-#define MOVES_MAX 9
+#ifndef BOARD_M
+#define BOARD_M 3
+#endif
+#ifndef BOARD_N
+#define BOARD_N 3
+#endif
+#ifndef BOARD_K
+#define BOARD_K 3
+#endif
+#define BOARD_3X3 (BOARD_M == 3 && BOARD_N == 3 && BOARD_K == 3)
 
-#define SQUARES_MAX 9 /* Total number of squares in the board. */
+#define SQUARES_MAX (BOARD_M * BOARD_N) /* Total number of squares in the board. */
+
+#if BOARD_K < 3 || BOARD_K > BOARD_M || BOARD_K > BOARD_N
+#error "BOARD_K must be at least 3, and at most BOARD_M and BOARD_N"
+#endif
+#if SQUARES_MAX > 36
+#error "The board can have at most 36 squares"
+#endif
+
+/*
+ * Total number of possible moves; highest is SQUARES_MAX (empty board); lowest
+ * is 0 (all squares taken).
+ */
+#define MOVES_MAX SQUARES_MAX
+
+/* Number of squares a line can start on in a row, and in a column. */
+#define LINE_STARTS_N (BOARD_N - BOARD_K + 1)
+#define LINE_STARTS_M (BOARD_M - BOARD_K + 1)
+
+/*
+ * Number of winning lines across, down, and along each of the two diagonals.
+ * winning_squares[] lists them in this order.
+ */
+#define LINES_ROW (BOARD_M * LINE_STARTS_N)
+#define LINES_COL (LINE_STARTS_M * BOARD_N)
+#define LINES_DIAG (LINE_STARTS_M * LINE_STARTS_N)
+
+/* Total number of winning lines in the board (8 for tic-tac-toe). */
+#define LINES_MAX (LINES_ROW + LINES_COL + 2 * LINES_DIAG)
+
+/*
+ * Most lines that go through a single square (BOARD_K in each of the four
+ * directions), plus one for the end of the list in square_lines[].
+ */
+#define SQUARE_LINES_MAX (4 * BOARD_K + 1)
+
+/*
+ * Number of ways to rotate or reflect the board onto itself, counting the
+ * identity. A board that is not square cannot be turned by 90 degrees.
+ */
+#if BOARD_M == BOARD_N
+#define SYMMETRIES 8
+#else
+#define SYMMETRIES 4
+#endif
+
+/* One bit per square (see board_pos.bb). */
+#if SQUARES_MAX <= 16
+typedef uint16_t bitboard_t;
+#elif SQUARES_MAX <= 32
+typedef uint32_t bitboard_t;
+#else
+typedef uint64_t bitboard_t;
+#endif
+
+/*
+ * Big enough for board_pos.index (3^10 still fits in 16 bits, and 3^20 in 32
+ * bits).
+ */
+#if SQUARES_MAX <= 10
+typedef uint16_t index_t;
+#elif SQUARES_MAX <= 20
+typedef uint32_t index_t;
+#else
+typedef uint64_t index_t;
+#endif
+
+/*
+ * Big enough for a board code (see board_pack()), which is twice an index: 2 *
+ * 3^9 still fits in 16 bits, and 2 * 3^19 in 32 bits.
+ */
+#if SQUARES_MAX <= 9
+typedef uint16_t code_t;
+#elif SQUARES_MAX <= 19
+typedef uint32_t code_t;
+#else
+typedef uint64_t code_t;
+#endif
+
+/* Characters of a board as board_write() writes it: its squares and the side. */
+#define BOARD_TEXT (SQUARES_MAX + 1)
 
 /*
  * Define a type for describing the state of an arbitrary square in the
@@ -45,17 +155,53 @@ enum {
 	WHITE, BLACK, EMPTY
 };
 
-/* Board position information. */
+/*
+ * Board position information. The fields are as small as they can be, so that
+ * a search keeps as little of the board around as possible: 22 bytes for
+ * tic-tac-toe with bitboards.
+ */
 struct board_pos {
-	int sq[SQUARES_MAX]; /* There are 9 squares, indexed 0 - 8. */
-	int color; /* The color that will make the next move. */
+#ifdef BITBOARD
+	/*
+	 * One mask per color, indexed by WHITE and BLACK; bit i is set if that
+	 * color has a piece on square i. A square is EMPTY if its bit is clear
+	 * in both masks.
+	 */
+	bitboard_t bb[2];
+#else
+	int8_t sq[SQUARES_MAX]; /* Squares are numbered row by row, from 0. */
+	/*
+	 * lines[c][i] is the number of pieces of color c on the line
+	 * winning_squares[i], and empties the number of EMPTY squares. They are
+	 * kept up to date by move_do() and move_undo().
+	 */
+	unsigned char lines[2][LINES_MAX];
+	uint8_t empties;
+	/*
+	 * The square of the move that move_do() just played, so that
+	 * checkmate() only has to look at the lines through it; MOVE_NONE if we
+	 * don't know it (after move_undo(), or for a board that was set up
+	 * directly). With bitboards, checkmate() checks every line at once.
+	 */
+	int8_t last;
+#endif
+	int8_t color; /* The color that will make the next move. */
+	/*
+	 * The squares read as a base-3 number, with square i as digit i: 0 for
+	 * EMPTY, 1 for WHITE and 2 for BLACK. Every position thus has its own
+	 * index, in 0 - 19682 for tic-tac-toe. index[s] is the index of the
+	 * board after applying symmetry[s] to it, so index[0] is the index of
+	 * the board itself. They are kept up to date by move_do() and
+	 * move_undo().
+	 */
+	index_t index[SYMMETRIES];
 };
 
 /* Move list used by AI. */
 struct move_list {
 	/*
 	 * A move is represented by the square that the X or O will fill in ---
-	 * the possible range is 0 - 8.
+	 * the possible range is 0 - 8 on the tic-tac-toe board.
 	 *
 	 * Since tic-tac-toe is played by placing X or O on an empty square,
 	 * move[] just holds all of the available empty squares. This info is
@@ -64,23 +210,43 @@ struct move_list {
 	 * The struct is called move_list because move[] will contain a list of
 	 * empty squares, each of which is a valid move. Hence, move_list.
 	 */
-	int move[MOVES_MAX];
+	int8_t move[MOVES_MAX];
 	/*
-	 * Number of empty squares; this is just a sum of how many non-null
-	 * values are inside move[].
+	 * Number of empty squares, which are in move[0] to move[moves - 1];
+	 * the rest of move[] is not set.
 	 */
-	int moves;
+	int8_t moves;
 };
 
 /*
- * Fake NULL value for an uninitialized move variable; this is needed because of
- * the int 'move' array used by move_list.
+ * Fake NULL value for a move variable that holds no move (such as the killer
+ * moves of a ply that did not cut off yet).
  */
 const int MOVE_NONE = -1;
-/* The best possible score for a given position. */
-const int INF = 100;
+/* The search depth of a player that is not the AI. */
+#define HUMAN -1
+/*
+ * The best possible score for a given position, and the most that a score in
+ * the transposition table can hold.
+ */
+const int INF = 127;
+/*
+ * Score of a game won with PLY pieces on the board, for the color that won it;
+ * the color that lost it gets minus that. The sooner the win, the higher the
+ * score, and the later the loss, the better for the loser. A position always
+ * has the same number of pieces, however it was reached, so its score does not
+ * depend on where it is in the search, and goes into the transposition table as
+ * it is. Every win scores more than eval() can return (at most LINES_MAX).
+ */
+#define SCORE_WIN(PLY) (INF - (PLY))
+/* If set, the score S says that the game is won or lost. */
+#define SCORE_DECIDED(S) \
+	((S) >= SCORE_WIN(SQUARES_MAX) || (S) <= -SCORE_WIN(SQUARES_MAX))
+/* Names of the squares, as the user types them in. */
+const char square_names[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+#if BOARD_3X3
 /* All winning three-in-a-row combinations in the game. */
-const int winning_squares[8][3] = {
+const int winning_squares[LINES_MAX][BOARD_K] = {
 	/* rows */
 	{0,1,2},
 	{3,4,5},
@@ -93,39 +259,832 @@ const int winning_squares[8][3] = {
 	{0,4,8},
 	{2,4,6}
 };
+/*
+ * For each square, the lines of winning_squares[] that go through it, ending
+ * with -1. A line goes through the center square in all four directions.
+ */
+const int square_lines[SQUARES_MAX][SQUARE_LINES_MAX] = {
+	{0, 3, 6, -1}, {0, 4, -1}, {0, 5, 7, -1},
+	{1, 3, -1}, {1, 4, 6, 7, -1}, {1, 5, -1},
+	{2, 3, 7, -1}, {2, 4, -1}, {2, 5, 6, -1}
+};
+
+/* Powers of 3, for board_pos.index. */
+const index_t pow3[SQUARES_MAX] = {
+	1, 3, 9, 27, 81, 243, 729, 2187, 6561
+};
+
+/*
+ * The symmetries of the board: symmetry[s][i] is the square that square i ends
+ * up on after rotating or reflecting the board.
+ */
+const int symmetry[SYMMETRIES][SQUARES_MAX] = {
+	{0, 1, 2, 3, 4, 5, 6, 7, 8}, /* identity */
+	{2, 5, 8, 1, 4, 7, 0, 3, 6}, /* rotate 90 degrees clockwise */
+	{8, 7, 6, 5, 4, 3, 2, 1, 0}, /* rotate 180 degrees */
+	{6, 3, 0, 7, 4, 1, 8, 5, 2}, /* rotate 270 degrees clockwise */
+	{2, 1, 0, 5, 4, 3, 8, 7, 6}, /* mirror left-right */
+	{6, 7, 8, 3, 4, 5, 0, 1, 2}, /* mirror top-bottom */
+	{0, 3, 6, 1, 4, 7, 2, 5, 8}, /* mirror along the 0-4-8 diagonal */
+	{8, 5, 2, 7, 4, 1, 6, 3, 0}  /* mirror along the 2-4-6 diagonal */
+};
+
+#else
+/* The same tables as above, for any board; see board_tables(). */
+int winning_squares[LINES_MAX][BOARD_K];
+int square_lines[SQUARES_MAX][SQUARE_LINES_MAX];
+index_t pow3[SQUARES_MAX];
+int symmetry[SYMMETRIES][SQUARES_MAX];
+#endif
+/*
+ * symmetry_inverse[s] is the symmetry that undoes symmetry[s], and
+ * square_weight[i] the number of lines through square i (on 3x3: 4 for the
+ * center, 3 for a corner, and 2 for an edge). Both are filled in by
+ * board_init().
+ */
+int symmetry_inverse[SYMMETRIES];
+int square_weight[SQUARES_MAX];
+
+#ifdef BITBOARD
+/* All squares occupied. */
+#define BOARD_FULL ((bitboard_t)(((uint64_t)1 << SQUARES_MAX) - 1))
+
+/*
+ * The bits of COUNT squares that are STEP squares apart, starting with square
+ * 0. This is the sum of a geometric series, so the masks below are all
+ * constant expressions, and the line checks of checkmate() and eval() are
+ * compiled for the board size.
+ */
+#define BOARD_RUN(COUNT, STEP) ((((uint64_t)1 << (COUNT) * (STEP)) - 1) \
+	/ (((uint64_t)1 << (STEP)) - 1))
+
+/*
+ * The squares that the lines in each direction start on: the end closest to
+ * square 0, or for the diagonals going down to the left, their top end.
+ */
+#define STARTS_ROW (BOARD_RUN(LINE_STARTS_N, 1) * BOARD_RUN(BOARD_M, BOARD_N))
+#define STARTS_COL (BOARD_RUN(BOARD_N, 1) * BOARD_RUN(LINE_STARTS_M, BOARD_N))
+#define STARTS_DIAG (BOARD_RUN(LINE_STARTS_N, 1) * BOARD_RUN(LINE_STARTS_M, BOARD_N))
+#define STARTS_ANTI (STARTS_DIAG << (BOARD_K - 1))
+
+/*
+ * Line I of a direction that has WIDTH lines starting on every row, the first
+ * one on column COL, and STEP squares from one square of the line to the next.
+ */
+#define LINE_AT(I, WIDTH, COL, STEP) (BOARD_RUN(BOARD_K, STEP) \
+	<< ((I) / (WIDTH) * BOARD_N + (I) % (WIDTH) + (COL)))
+/* Line L of winning_squares[], one bit per square (0 past the last line). */
+#define LINE_MASK(L) ((L) < LINES_ROW ? LINE_AT(L, LINE_STARTS_N, 0, 1) \
+	: (L) < LINES_ROW + LINES_COL \
+		? LINE_AT((L) - LINES_ROW, BOARD_N, 0, BOARD_N) \
+	: (L) < LINES_ROW + LINES_COL + LINES_DIAG \
+		? LINE_AT((L) - LINES_ROW - LINES_COL, LINE_STARTS_N, 0, BOARD_N + 1) \
+	: (L) < LINES_MAX \
+		? LINE_AT((L) - LINES_ROW - LINES_COL - LINES_DIAG, LINE_STARTS_N, \
+			BOARD_K - 1, BOARD_N - 1) \
+	: 0)
+
+/* Room for the lines of any board up to 36 squares (6x6 has 80 lines). */
+#define LINES_CAP 128
+#if LINES_MAX > LINES_CAP
+#error "Too many lines for winning_masks[]"
+#endif
+#define LINE_MASKS_4(L) LINE_MASK(L), LINE_MASK((L) + 1), LINE_MASK((L) + 2), \
+	LINE_MASK((L) + 3)
+#define LINE_MASKS_16(L) LINE_MASKS_4(L), LINE_MASKS_4((L) + 4), \
+	LINE_MASKS_4((L) + 8), LINE_MASKS_4((L) + 12)
+#define LINE_MASKS_64(L) LINE_MASKS_16(L), LINE_MASKS_16((L) + 16), \
+	LINE_MASKS_16((L) + 32), LINE_MASKS_16((L) + 48)
+
+/*
+ * Boards with at most this many lines (3x3 has 8, 4x4 has 10) have checkmate()
+ * test them one by one rather than with line_run(): the shifts only pay off
+ * with more (4x4 with 3 in a row has 24).
+ */
+#define CHECKMATE_LOOP_LINES 16
+
+/* The same lines as winning_squares[], one bit per square. */
+const bitboard_t winning_masks[LINES_CAP] = {
+	LINE_MASKS_64(0), LINE_MASKS_64(64)
+};
+/*
+ * The same masks again, but built by board_init() at startup, for the generic
+ * versions of checkmate() and eval() that -k compares them with.
+ */
+bitboard_t line_masks[LINES_MAX];
+
+/*
+ * The batch versions of checkmate() and eval() work on vectors of bitboards,
+ * one board in each lane, with GCC's vector extensions: with -march=native,
+ * every operation on a vector is one AVX2 (or AVX-512) instruction for all of
+ * its lanes. Without them, the vectors are the 16 bytes of SSE2 (or NEON),
+ * and on machines without vector registers GCC splits them into plain scalar
+ * code.
+ */
+#if defined(__AVX512BW__)
+#define VECTOR_BYTES 64
+#elif defined(__AVX2__)
+#define VECTOR_BYTES 32
+#else
+#define VECTOR_BYTES 16
+#endif
+#define BATCH_LANES ((int)(VECTOR_BYTES / sizeof(bitboard_t)))
+typedef bitboard_t bitboard_vec __attribute__((vector_size(VECTOR_BYTES)));
+
+/* Boards in a struct board_batch (a multiple of BATCH_LANES). */
+#define BATCH_MAX 256
+
+/*
+ * Positions laid out as a structure of arrays, so that the pieces of
+ * BATCH_LANES boards in a row load into one vector: ours are the pieces of
+ * the color to move, and theirs the pieces of the color that just moved.
+ */
+struct board_batch {
+	bitboard_t ours[BATCH_MAX] __attribute__((aligned(VECTOR_BYTES)));
+	bitboard_t theirs[BATCH_MAX] __attribute__((aligned(VECTOR_BYTES)));
+	int count;
+};
+#endif
+
+#if BOARD_3X3
+/* Number of different values of board_pos.index (3^9). */
+#define POSITIONS_MAX 19683
+
+/*
+ * The transposition table has one entry for every position index and color to
+ * move, so no two positions ever share an entry (but symmetric positions do,
+ * if sym_enabled is set).
+ */
+#define TT_SIZE (POSITIONS_MAX * 2)
+#define TT_SLOT(KEY) (KEY)
+#define TT_CHECK(KEY) 0
+typedef uint32_t tt_word;
+#else
+/*
+ * Larger boards have far too many positions to give each its own entry, so
+ * the transposition table has 2^TT_BITS entries, and a position goes into the
+ * entry picked by the top bits of a hash of its key (see tt_key()). Each entry
+ * keeps the low bits of the hash in TT_CHECK(), so that we can tell whether an
+ * entry belongs to the position or to another one with the same slot. With
+ * TT_BITS of 22 or more, the slot and check bits together hold the whole hash;
+ * with fewer, two positions can be taken for each other, but only one time in
+ * 2^(42 + TT_BITS). An entry is simply overwritten by the last position stored
+ * in it.
+ */
+#ifndef TT_BITS
+#define TT_BITS 22
+#endif
+#if TT_BITS < 16 || TT_BITS > 30
+#error "TT_BITS must be between 16 and 30"
+#endif
+#define TT_SIZE (1 << TT_BITS)
+#define TT_HASH(KEY) ((uint64_t)(KEY) * 0x9E3779B97F4A7C15ULL)
+#define TT_SLOT(KEY) (TT_HASH(KEY) >> (64 - TT_BITS))
+#define TT_CHECK(KEY) (TT_HASH(KEY) << TT_DATA_BITS)
+typedef uint64_t tt_word;
+#endif
+
+/*
+ * Kinds of scores stored in the transposition table. An alpha-beta search that
+ * prunes moves only learns a bound on the score: LOWER means that the real
+ * score is at least the stored score, and UPPER that it is at most the stored
+ * score. Like the scores of minimax() and alphabeta(), stored scores are from
+ * the point of view of the side to move, which is part of the key.
+ */
+enum {
+	BOUND_NONE, BOUND_EXACT, BOUND_LOWER, BOUND_UPPER
+};
+
+/*
+ * Transposition table entry; bound is BOUND_NONE if the entry is unused, and
+ * move is the best move found in the position (or MOVE_NONE), on the board as
+ * it is stored (see tt_key()). In the table itself, an entry is packed into the
+ * low TT_DATA_BITS bits of a single tt_word (see TT_PACK()), below TT_CHECK()
+ * of its position, so that threads can read and write entries at the same time
+ * without locks: a thread always reads an entry that some thread wrote as a
+ * whole.
+ */
+struct tt_entry {
+	signed char score;
+	signed char depth; /* At most SQUARES_MAX, so it fits in 6 bits. */
+	unsigned char bound;
+	signed char move;
+};
+#define TT_DATA_BITS 22
+#define TT_PACK(E) ((uint8_t)(E).score | (E).depth << 8 | (E).bound << 14 \
+	| ((E).move + 1) << 16)
+#define TT_UNPACK(E, W) ((E).score = (int8_t)(W), (E).depth = ((W) >> 8) & 0x3F, \
+	(E).bound = ((W) >> 14) & 3, (E).move = (((W) >> 16) & 0x3F) - 1)
+
+/*
+ * Boards with more squares than this have too many positions to solve them
+ * all (3^16 is already 43 million).
+ */
+#define SOLUTION_SQUARES_MAX 16
+
+/*
+ * solution_build() splits the positions with the same number of pieces into
+ * 3^SOLUTION_SPLIT chunks, one for each way to fill the highest SOLUTION_SPLIT
+ * squares, for its threads to take in turn.
+ */
+#define SOLUTION_SPLIT 4
+
+/*
+ * A layer of solution_build(): the positions with ply pieces, which threads
+ * solve one chunk (see SOLUTION_SPLIT) at a time. A chunk is a range of
+ * indices of its own, so no two threads write the same entry.
+ */
+struct solution_layer {
+	int ply;
+	atomic_int next; /* Next chunk to solve. */
+};
+
+/*
+ * Solution table entries: bit 15 is set if the position is solved, bits 12 -
+ * 13 hold the result of perfect play (SOLVED_DRAW, SOLVED_WHITE or
+ * SOLVED_BLACK for a win by either color), bits 6 - 11 the number of moves
+ * until the game ends, and bits 0 - 5 the best move, plus 1 (0 if the game is
+ * over).
+ */
+#define SOLVED 0x8000
+#define SOLVED_DRAW 0
+#define SOLVED_WHITE 1
+#define SOLVED_BLACK 2
+#define SOLVED_ENTRY(RESULT, DISTANCE, MOVE) \
+	(SOLVED | (RESULT) << 12 | (DISTANCE) << 6 | ((MOVE) + 1))
+#define SOLVED_RESULT(E) (((E) >> 12) & 3)
+#define SOLVED_DISTANCE(E) (((E) >> 6) & 0x3F)
+#define SOLVED_MOVE(E) (((E) & 0x3F) - 1)
+
+/* Entries of the solution table: one for every base 3 index of a board. */
+#define SOLUTION_SIZE ((size_t)pow3[SQUARES_MAX - 1] * 3)
+
+/*
+ * The solution file (see solution_map()) starts with this header, and goes on
+ * with the entries of the solution table as they are in memory. Raise
+ * SOLUTION_VERSION whenever the entries change, so that old files are solved
+ * again. The order is SOLUTION_ORDER as the machine that wrote the file stores
+ * it, to tell its byte order.
+ */
+#define SOLUTION_MAGIC "simtic\n"
+#define SOLUTION_VERSION 2
+#define SOLUTION_ORDER 0x01020304
+
+/*
+ * The header of the solution file. solution_map() only maps a file whose
+ * header is the one that solution_header_init() fills in for this build, with
+ * the checksum of the entries that follow it.
+ */
+struct solution_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t order;
+	uint8_t board[4]; /* BOARD_M, BOARD_N, BOARD_K, and bytes per entry */
+	uint32_t entries;
+	uint32_t checksum; /* of the entries (see solution_checksum()) */
+};
+
+/* Most threads that can search at the same time. */
+#define THREADS_MAX 64
+
+/* Nodes between two looks at the clock by budget_check(). */
+#define BUDGET_INTERVAL 1024
+
+/* Search algorithms that move_pick() can use. */
+enum {
+	SEARCH_MINIMAX, SEARCH_ALPHABETA
+};
+
+/*
+ * How much report() prints: nothing, the game (boards, moves and results), or
+ * also what each search of the AI found.
+ */
+enum {
+	VERBOSITY_QUIET, VERBOSITY_GAME, VERBOSITY_SEARCH
+};
+
+/* Longest board that board_frame() writes, with its rules and blank lines. */
+#define FRAME_MAX ((2 * BOARD_M + 1) * (4 * BOARD_N + 2) + 3)
+
+/*
+ * Counters of a search, zeroed at the start of every search and summed over
+ * its threads, and over the searches of iterative deepening, with stats_add().
+ */
+struct search_stats {
+	/*
+	 * Nodes searched (which serves to verify the difficulty levels),
+	 * transposition table lookups that did (hits) and didn't (misses) spare
+	 * us a search, and positions where alphabeta() cut off, and how many of
+	 * those cut off right on the first move searched.
+	 */
+	unsigned int nodes, tt_hits, tt_misses, cutoffs, cutoffs_first;
+	/*
+	 * The rest are only counted in a build with -DSTATS (see the Makefile),
+	 * as counting them slows down the search.
+	 */
+	/* Calls of checkmate(), eval() and move_generate(). */
+	unsigned long checkmates, evals, generates;
+	/* Nodes scored with eval() at the horizon, and nodes with moves searched. */
+	unsigned long leaves, interior;
+	/* Nodes where the game was over, won or drawn. */
+	unsigned long wins, draws;
+	unsigned long tt_probes; /* Lookups in the transposition table. */
+};
+
+#ifdef STATS
+#define STAT(E, FIELD) ((E)->stats.FIELD++)
+#else
+#define STAT(E, FIELD) ((void)0)
+#endif
+
+/* What move_pick() found, for the UI to report. */
+struct search_result {
+	int move; /* Best move. */
+	int score; /* Its score, from White's point of view. */
+	/* Deepest search that finished (less than asked for on a budget). */
+	int depth;
+	bool budget; /* If set, the search had a budget of time or nodes. */
+	bool lookup; /* If set, the move was looked up in the solution table. */
+	/* With lookup, moves until the game ends (see solution_distance()), or -1. */
+	int distance;
+	struct search_stats stats; /* Counters of the search, over all threads. */
+	/* Move and nodes of the minimax search of search_compare. */
+	int move_minimax;
+	unsigned int nodes_minimax;
+	double seconds; /* Time the search took. */
+};
+
+/* What perft() found, by ply from the position it started from. */
+struct perft_counts {
+	unsigned long nodes[MOVES_MAX + 1];
+	unsigned long wins[MOVES_MAX + 1]; /* Positions where the last move won. */
+	unsigned long draws[MOVES_MAX + 1]; /* Full boards that nobody won. */
+};
+
+/*
+ * A search of the moves of the root position that is split up between threads:
+ * each thread takes the next move that nobody searched yet, until all of them
+ * are searched. See move_search_parallel().
+ */
+struct root_job {
+	struct board_pos pos;
+	struct move_list mlist;
+	int depth;
+	int type;
+	/*
+	 * If set, each thread searches all root moves instead (see
+	 * move_search_smp()), and score[] and next are not used.
+	 */
+	bool smp;
+	/* score[i] is the score of mlist.move[i], for the side that plays it. */
+	int score[MOVES_MAX];
+	atomic_int next; /* Next move of mlist.move[] to search. */
+	int running; /* Pool threads that are still searching. */
+	struct search_stats stats; /* Sums of the counters of all threads. */
+	struct engine *engine; /* The engine whose search this is. */
+};
+
+/*
+ * Everything that a search changes as it goes, so that searches with engines
+ * of their own can run at the same time, on any thread. An engine holds all
+ * the memory that its searches need, so a search never allocates any; what it
+ * shares with other engines (the transposition table, and with the threads
+ * that help it, the stop flags) it reaches through pointers, which
+ * engine_init() sets up.
+ */
+struct engine {
+	_Atomic tt_word *tt; /* TT_SIZE entries. */
+	/*
+	 * Tells the search to stop: the threads helping move_search_smp() once
+	 * the search is done, or all of them once the search went over its
+	 * budget, which also sets budget_hit. They point to stop_flag and
+	 * hit_flag, or to those of the engine that we help.
+	 */
+	atomic_bool *stop, *budget_hit;
+	atomic_bool stop_flag, hit_flag;
+	struct search_stats stats; /* Counters of the last move_search(). */
+	/*
+	 * Nodes (stats.nodes) of all searches whose moves were played (with
+	 * search_compare, only those of alphabeta()), for self-play statistics.
+	 */
+	unsigned long nodecount_total;
+	/*
+	 * Move ordering of alphabeta() (see move_order()). killers[p] are the
+	 * last two moves that made the search cut off in a position with p
+	 * pieces on the board, and history[c][i] adds up depth * depth over
+	 * every cutoff by a move of color c on square i. Both are cleared by
+	 * order_reset() at the start of every search.
+	 */
+	int killers[SQUARES_MAX][2];
+	unsigned int history[2][SQUARES_MAX];
+	/*
+	 * Engines helping move_search_smp() rotate every move list by this
+	 * much, so that they search moves in a different order than the others.
+	 */
+	int order_shift;
+	/*
+	 * Root move to search first, or MOVE_NONE for none: the best move found
+	 * at the depth before by move_search_deepening().
+	 */
+	int root_first;
+	/*
+	 * The budget of move_search_deepening(), as budget_ms and budget_nodes.
+	 * While budget_active is set, the search checks at every node whether
+	 * it went over budget_nodes or budget_deadline (see budget_check()).
+	 * deepening_nodes are the nodes searched to the earlier depths.
+	 */
+	long budget_ms;
+	unsigned long budget_nodes;
+	bool budget_active;
+	struct timespec budget_deadline;
+	unsigned long deepening_nodes;
+	struct root_job job; /* For the pool, in a search with threads. */
+#ifdef BITBOARD
+	/* The positions scored by move_pick_leaves(), and what they came from. */
+	struct board_batch batch;
+	int owner[BATCH_MAX], move[BATCH_MAX], won[BATCH_MAX], points[BATCH_MAX];
+#endif
+};
 
-/* Tell user how many times we called minimax(); this serves to verify the
- * difficulty levels. */
-static unsigned int nodecount;
+/* Most games that -x plays at once. */
+#define SESSIONS_MAX 1024
+/* Longest line that a client of -x may send, with its newline. */
+#define SESSION_LINE_MAX 64
+/* Searches of the same depth that a session worker takes from the queue at once. */
+#define SESSION_BATCH 8
+
+/* What a session is waiting for. */
+#define SESSION_NEW 0 /* a "new" command */
+#define SESSION_HUMAN 1 /* a move of the human */
+#define SESSION_AI 2 /* a move of the AI, from a session worker */
+#define SESSION_OVER 3 /* nothing; the game is over */
+
+/*
+ * A game on a connection to the socket of -x (see sessions_serve()). While the
+ * AI is to move (SESSION_AI), the session belongs to the session workers, and
+ * the event loop only touches it again once its search is done.
+ */
+struct session {
+	struct board_pos pos;
+	struct search_result result;
+	unsigned long seq; /* When its search was queued, to keep them in order. */
+	bool used;
+	bool closed; /* The client went away while the AI was searching. */
+	int fd;
+	int state;
+	int depth; /* Search depth of the AI, from the level of the game. */
+	int human; /* Color of the human. */
+	int in_len;
+	char in[SESSION_LINE_MAX];
+};
+
+/* How much report() prints; self-play always plays quietly. */
+static int verbosity = VERBOSITY_SEARCH;
+/* The search algorithm used by move_pick(). */
+static int search_type = SEARCH_ALPHABETA;
+/*
+ * If set, move_pick() runs both minimax() and alphabeta() and reports the
+ * nodecount of each, so that we can check that pruning does not change the
+ * move picked.
+ */
+static bool search_compare = false;
+/*
+ * Scores of positions that were already searched, so that we don't search them
+ * again when we reach them through a different move order. The table is kept
+ * across moves and games, and shared by all engines (see engine_init()).
+ */
+static _Atomic tt_word tt[TT_SIZE];
+static bool tt_enabled = true;
+/*
+ * If set, symmetric positions are treated as the same position: they share a
+ * transposition table entry, and move_generate() only generates one move out of
+ * every set of moves that lead to symmetric positions.
+ */
+static bool sym_enabled = true;
+/*
+ * Best move, result and distance to the end of the game under perfect play for
+ * every position, indexed by board_pos.index[0] (in a position that can come
+ * up in a game, the pieces tell whose move it is). Allocated and filled in
+ * once by solution_init() before any search, so that move_pick() can answer
+ * any search that would reach the end of the game with a single lookup.
+ */
+static uint16_t *solution;
+static bool solution_enabled = SQUARES_MAX <= SOLUTION_SQUARES_MAX;
+/*
+ * If set, the solution table is mapped from this file instead of solved, and
+ * saved to it after it is solved (see solution_map()).
+ */
+static const char *solution_path;
+/*
+ * Number of threads that search the root position in parallel, counting the
+ * thread that calls move_search(). The others wait in the thread pool for a
+ * new pool_job, and tell when they are done with pool_done. The pool has
+ * pool_size threads, but only the first threads - 1 of them take part.
+ */
+static int threads = 1;
+static int pool_size;
+/*
+ * If set, threads do not split up the root moves; they all search the same
+ * position at once, and help each other through the transposition table (see
+ * move_search_smp()).
+ */
+static bool smp_enabled = false;
+/*
+ * Most time (in milliseconds) and nodes that move_search_deepening() may spend
+ * on a move; 0 for no limit. Every engine starts out with these (-i and -n).
+ */
+static long budget_ms = 0;
+static unsigned long budget_nodes = 0;
+/*
+ * If set, move_pick() reports every search on its own line here (see
+ * log_result()).
+ */
+static FILE *search_log;
+/*
+ * The job of the search that the pool is helping, if pool_busy is set: only
+ * one engine at a time can have the pool's help (see pool_claim()).
+ */
+static struct root_job *pool_job;
+static bool pool_busy;
+static unsigned int pool_generation;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+/*
+ * The games of -x. Sessions whose AI is to move wait in session_queue, a heap
+ * that puts the shallowest search first (see session_before()), for the
+ * session workers, which put them in session_done when they are done and tell
+ * the event loop through session_event. Both lists are guarded by
+ * session_lock.
+ */
+static struct session sessions[SESSIONS_MAX];
+static int session_queue[SESSIONS_MAX];
+static int session_queued;
+static int session_done[SESSIONS_MAX];
+static int session_finished;
+static unsigned long session_seq;
+static int session_event;
+static int session_workers;
+static pthread_mutex_t session_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t session_wake = PTHREAD_COND_INITIALIZER;
 
 /* FUNCTION PROTOTYPES */
 
 /* Game mechanics */
-void game_loop();
-void newgame(bool human, int depth);
-void make_move(struct board_pos *pos, bool human, int depth);
-int move_pick(struct board_pos *pos, int depth);
+void game_loop(struct engine *e);
+void selfplay(struct engine *e, int games, int depth_white, int depth_black);
+int newgame(struct engine *e, int depth_white, int depth_black);
+void make_move(struct engine *e, struct board_pos *pos, bool human, int depth);
+void engine_init(struct engine *e);
+struct search_result move_pick(struct engine *e, struct board_pos *pos, int depth);
+int move_search(struct engine *e, struct board_pos *pos, int depth, int type, int *score);
+int root_search(struct engine *e, struct board_pos *pos, int depth, int type, int *score);
+int move_search_parallel(struct engine *e, struct board_pos *pos, int depth,
+	int type, int *score);
+int move_search_smp(struct engine *e, struct board_pos *pos, int depth,
+	int type, int *score);
+int move_search_deepening(struct engine *e, struct board_pos *pos,
+	int depth_max, int type, int *score, int *depth_done);
+void budget_check(struct engine *e);
+void stats_add(struct search_stats *sum, struct search_stats *add);
+/* Thread pool */
+bool pool_claim(struct engine *e);
+void pool_release();
+void pool_init(int count);
+void *pool_thread(void *arg);
+void pool_search(struct engine *e, struct root_job *job);
+void move_pick_batch(struct engine *e, struct board_pos *pos, int count,
+	int depth, int *moves, int *scores);
+#ifdef BITBOARD
+void move_pick_leaves(struct engine *e, struct board_pos *pos, int count, int *moves,
+	int *scores);
+void leaves_score(struct engine *e, struct board_pos *pos, int *moves, int *scores);
+#endif
+void evaluate(struct engine *e, int depth);
+void serve(struct engine *e, int depth_default);
+const char *serve_request(struct engine *e, char *line, struct board_pos *pos,
+	int *depth);
+/* Game sessions */
+int sessions_serve(const char *path);
+int session_listen(const char *path);
+void session_accept(int listener, int ep);
+void session_read(int slot);
+void session_command(int slot, char *line);
+void session_search(int slot);
+void session_finish(int slot);
+void session_reply(int slot, int ai_move);
+void session_send(int slot, const char *line);
+void session_close(int slot);
+void *session_worker(void *arg);
+bool session_before(int a, int b);
+void session_push(int slot);
+int session_pop();
+/* Benchmarks */
+void bench_kernels();
+void bench_solve();
+int bench_positions(struct board_pos *pos, int count, int plies_min, bool open);
+int bench_text(struct board_pos *pos);
+int bench_code(struct board_pos *pos);
+double bench_time(int (*kernel)(struct board_pos *), struct board_pos *pos, int rounds);
+#ifdef BITBOARD
+double bench_batch(void (*kernel)(struct board_batch *, int *), struct board_batch *batch,
+	int rounds);
+#endif
+#ifdef BENCH
+void bench_suite(struct engine *e);
+int bench_generate(struct board_pos *pos);
+double bench_do_undo(struct board_pos *pos);
+double bench_search(struct engine *e, struct board_pos *pos, int count,
+	int depth, bool pick, unsigned long *nodes);
+void bench_report(const char *name, double *ns, double nodes);
+#endif
+void perft_boards(int depth);
+void perft_report(struct board_pos *pos, int depth);
+void perft(struct board_pos *pos, int depth, int ply, struct perft_counts *counts);
 /* Evaluation */
 int checkmate(struct board_pos *pos);
 int eval(struct board_pos *pos);
+int score_won(struct board_pos *pos);
+#ifdef BITBOARD
+bitboard_t line_run(bitboard_t pieces, int step, bitboard_t starts);
+int checkmate_generic(struct board_pos *pos);
+int eval_generic(struct board_pos *pos);
+void batch_add(struct board_batch *batch, struct board_pos *pos);
+void batch_checkmate(struct board_batch *batch, int *won);
+void batch_eval(struct board_batch *batch, int *points);
+bitboard_vec vec_line_run(bitboard_vec pieces, int step, bitboard_t starts);
+bitboard_vec vec_line_one(bitboard_vec pieces, int step, bitboard_t starts);
+bitboard_vec vec_popcount(bitboard_vec v);
+#endif
 /* Search */
-int minimax(struct board_pos *pos, int depth);
+int minimax(struct engine *e, struct board_pos *pos, int depth);
+int alphabeta(struct engine *e, struct board_pos *pos, int depth, int alpha, int beta);
+/* Transposition table */
+bool tt_probe(struct engine *e, struct board_pos *pos, int depth, int *alpha,
+	int *beta, int *score, int *move);
+int tt_move(struct engine *e, struct board_pos *pos);
+bool tt_lookup(struct engine *e, struct board_pos *pos, struct tt_entry *entry);
+void tt_store(struct engine *e, struct board_pos *pos, int depth, int score,
+	int bound, int move);
+void tt_clear(struct engine *e);
+uint64_t tt_key(struct board_pos *pos, int *sym);
+/* Perfect play table */
+bool solution_ready();
+void solution_init();
+void solution_build(int count);
+void *solution_worker(void *arg);
+void solution_fill(struct board_pos *pos, int sq, int white, int black);
+bool solution_map(const char *path);
+void solution_save(const char *path);
+void solution_header_init(struct solution_header *header);
+uint32_t solution_checksum(const uint16_t *entries, size_t count);
+unsigned int solution_solve(struct board_pos *pos);
+int solution_lookup(struct board_pos *pos, int *score);
+int solution_distance(struct board_pos *pos);
 /* Move handling */
 void move_generate(struct board_pos *pos, struct move_list *mp);
+void move_generate_all(struct board_pos *pos, struct move_list *mp);
+void move_rotate(struct move_list *mp, int shift);
+void move_order(struct engine *e, struct board_pos *pos, struct move_list *mp,
+	int hash_move);
+void order_reset(struct engine *e);
 void move_do(struct board_pos *pos, int move);
 void move_undo(struct board_pos *pos, int move);
-/* Misc board helper */
+/* Misc board helpers */
 bool board_empty(struct board_pos *pos);
+int board_empty_count(struct board_pos *pos);
+index_t board_canonical(struct board_pos *pos, int *sym);
+void board_init();
+void board_tables();
+void board_index_add(struct board_pos *pos, int sq, int digit);
+void board_reset(struct board_pos *pos);
+int board_square(struct board_pos *pos, int sq);
+bool board_parse(struct board_pos *pos, const char *str);
+const char *board_read(struct board_pos *pos, const char *str);
+int board_write(struct board_pos *pos, char *buf);
+code_t board_pack(struct board_pos *pos);
+bool board_unpack(struct board_pos *pos, code_t code);
+bool board_settle(struct board_pos *pos, int white, int black);
 /* UI helpers */
+void report(int level, const char *format, ...);
+int read_key();
 void display_moves(struct move_list *mp);
+void display_result(struct search_result *result, int depth);
+void log_result(struct board_pos *pos, struct search_result *result, int depth);
 void display_board(struct board_pos *pos);
+int board_frame(struct board_pos *pos, char *buf);
+char *frame_rule(char *p);
+void usage();
 
-int main()
+int main(int argc, char **argv)
 {
+	static struct engine engine;
 	struct termios orig, rawmode;
+	int opt, games, depth_white, depth_black, depth_eval, depth_perft;
+	const char *log_path;
+	bool eval_mode, bench_mode, serve_mode;
+	const char *session_path;
+
+	log_path = NULL;
+	session_path = NULL;
+	eval_mode = false;
+	bench_mode = false;
+	serve_mode = false;
+	depth_eval = MOVES_MAX;
+	depth_perft = 0;
+	games = 0;
+	depth_white = MOVES_MAX;
+	depth_black = MOVES_MAX;
+	while ((opt = getopt(argc, argv, "b:cd:ef:g:i:j:klmn:o:pr:stuv:w:x:")) != -1) {
+		switch (opt) {
+		case 'b': depth_black = atoi(optarg); break;
+		case 'c': search_compare = true; break;
+		case 'd': depth_eval = atoi(optarg); break;
+		case 'e': eval_mode = true; break;
+		case 'f': depth_perft = atoi(optarg); break;
+		case 'g': games = atoi(optarg); break;
+		case 'i': budget_ms = atol(optarg); break;
+		case 'j': threads = atoi(optarg); break;
+		case 'k': bench_mode = true; break;
+		case 'l': smp_enabled = true; break;
+		case 'm': search_type = SEARCH_MINIMAX; break;
+		case 'n': budget_nodes = strtoul(optarg, NULL, 10); break;
+		case 'o': log_path = optarg; break;
+		case 'p': solution_enabled = false; break;
+		case 'r': solution_path = optarg; break;
+		case 's': sym_enabled = false; break;
+		case 't': tt_enabled = false; break;
+		case 'u': serve_mode = true; break;
+		case 'v': verbosity = atoi(optarg); break;
+		case 'w': depth_white = atoi(optarg); break;
+		case 'x': session_path = optarg; break;
+		default: usage(); return 1;
+		}
+	}
+	if (optind < argc || games < 0 || budget_ms < 0
+		|| verbosity < VERBOSITY_QUIET || verbosity > VERBOSITY_SEARCH
+		|| depth_white < 0 || depth_white > MOVES_MAX
+		|| depth_black < 0 || depth_black > MOVES_MAX
+		|| depth_eval < 0 || depth_eval > MOVES_MAX
+		|| depth_perft < 0 || depth_perft > MOVES_MAX
+		|| threads < 1 || threads > THREADS_MAX
+		|| (session_path && (smp_enabled || search_compare))) {
+		usage();
+		return 1;
+	}
 
-	/* Disable buffering for easier debugging. */
-        setvbuf(stdout, NULL, _IONBF ,0);
+	/* Each line goes out as soon as it is written, for those who follow it. */
+	if (log_path) {
+		search_log = fopen(log_path, "a");
+		if (!search_log) {
+			perror(log_path);
+			return 1;
+		}
+		setvbuf(search_log, NULL, _IOLBF, 0);
+	}
+
+	board_init();
+	if (bench_mode) {
+		bench_kernels();
+		bench_solve();
+		return 0;
+	}
+	if (depth_perft) {
+		perft_boards(depth_perft);
+		return 0;
+	}
+	if (session_path)
+		return sessions_serve(session_path);
+	pool_init(threads - 1);
+	engine_init(&engine);
+#ifdef BENCH
+	/*
+	 * The benchmark binary (see the Makefile) runs the benchmarks with the
+	 * options that change the search (such as -t or -j), and exits.
+	 */
+	bench_suite(&engine);
+	return 0;
+#endif
+
+	/*
+	 * Solve the game before any engine searches, as engines on other
+	 * threads would all set up the solution table at once.
+	 */
+	solution_ready();
+
+	/* Self-play needs no terminal. */
+	if (games) {
+		selfplay(&engine, games, depth_white, depth_black);
+		return 0;
+	}
+	if (eval_mode) {
+		evaluate(&engine, depth_eval);
+		return 0;
+	}
+	if (serve_mode) {
+		serve(&engine, depth_eval);
+		return 0;
+	}
 
 	/* Get current terminal settings. */
         tcgetattr(0, &orig);
@@ -141,7 +1100,7 @@ int main()
 	/* Apply these settings to the current terminal. */
         tcsetattr(0, TCSANOW, &rawmode);
 
-	game_loop();
+	game_loop(&engine);
 
 	/* restore terminal settings before exiting */
         tcsetattr(0, TCSANOW, &orig);
@@ -149,7 +1108,54 @@ int main()
 	return 0;
 }
 
-void game_loop()
+void usage()
+{
+	printf("usage: simtic [-c] [-m] [-p] [-s] [-t] [-v level] [-j threads [-l]]\n");
+	printf("              [-i milliseconds] [-n nodes] [-o file] [-r file]\n");
+	printf("              [-g games [-w depth] [-b depth]]\n");
+	printf("              [-e [-d depth]] [-f depth] [-k] [-u] [-x socket]\n");
+	printf("  -b  search depth of Black (O) in self-play (default %d)\n", MOVES_MAX);
+	printf("  -c  run both minimax and alpha-beta search, and compare nodecounts\n");
+	printf("  -d  search depth for -e (default %d)\n", MOVES_MAX);
+	printf("  -e  read one board per line from standard input, such as XO.X.....\n");
+	printf("      for X on squares 0 and 3 and O on square 1, and print the best\n");
+	printf("      move and its score for each (XO.X.....o also gives the side\n");
+	printf("      to move)\n");
+	printf("  -f  read boards like -e, and count the positions this many moves\n");
+	printf("      deep from each, ply by ply, with the games won and drawn\n");
+	printf("  -g  play this many games of AI against AI without a terminal, and\n");
+	printf("      report how fast they were played\n");
+	printf("  -i  search each move of the AI to depth 0, 1, 2, ... for at most\n");
+	printf("      this long, and play the best move of the deepest search that\n");
+	printf("      finished; the difficulty level (or -w and -b) is the deepest\n");
+	printf("      it goes\n");
+	printf("  -j  search the moves of a position with this many threads (default 1),\n");
+	printf("      and solve perfect play with as many\n");
+	printf("  -k  time the line checks compiled in for this board size against\n");
+	printf("      generic ones that look the lines up in a table, and\n");
+	printf("      versions that check many boards at once; and solving perfect\n");
+	printf("      play with 1 to -j threads, and writing and reading boards\n");
+	printf("  -l  with -j, have all threads search the whole position, sharing\n");
+	printf("      the transposition table (Lazy SMP)\n");
+	printf("  -m  use plain minimax search instead of alpha-beta\n");
+	printf("  -n  like -i, but stop after searching this many nodes\n");
+	printf("  -o  append a line of key=value pairs on each search of the AI\n");
+	printf("      to this file\n");
+	printf("  -p  always search, instead of looking up perfect play\n");
+	printf("  -r  map the perfect play table from this file, or solve it and\n");
+	printf("      save it there if the file is missing or out of date\n");
+	printf("  -s  do not merge symmetric positions in the search\n");
+	printf("  -t  do not use the transposition table\n");
+	printf("  -u  answer search requests on standard input, one per line, such\n");
+	printf("      as XO.X..... x depth=3, with \"move score nodes\" (see README.md)\n");
+	printf("  -v  what to print while playing: 0 for only the prompts, 1 for\n");
+	printf("      the game too, 2 for what each search found too (default 2)\n");
+	printf("  -w  search depth of White (X) in self-play (default %d)\n", MOVES_MAX);
+	printf("  -x  play a game with every client of a UNIX socket at this path,\n");
+	printf("      searching with -j threads (see README.md)\n");
+}
+
+void game_loop(struct engine *e)
 {
 	bool human = false;
 	int depth;
@@ -159,7 +1165,7 @@ start_game_loop:
 
 move_first_menu:
 	printf("\nWould you like to move first? (y/n) ");
-	switch (getchar()) {
+	switch (read_key()) {
 	case 'y': human = true; break;
 	case 'n': human = false; break;
 	default: goto move_first_menu;
@@ -167,18 +1173,21 @@ move_first_menu:
 
 difficulty_menu:
 	printf("\nChoose difficulty ([h]ard/[m]edium/[e]asy): ");
-	switch (getchar()) {
-	case 'h': depth = 9; break;
+	switch (read_key()) {
+	case 'h': depth = MOVES_MAX; break;
 	case 'm': depth = 3; break;
 	case 'e': depth = 1; break;
 	default: goto difficulty_menu;
 	}
 
-	newgame(human, depth);
+	if (human)
+		newgame(e, HUMAN, depth);
+	else
+		newgame(e, depth, HUMAN);
 
 newgame_menu:
 	printf("\nPlay again? (y/n) ");
-	switch (getchar()) {
+	switch (read_key()) {
 	case 'y': goto start_game_loop;
 	case 'n': goto exit_game_loop;
 	default: goto newgame_menu;
@@ -188,136 +1197,2112 @@ exit_game_loop:
 	printf("\nGoodbye!\n");
 }
 
-void newgame(bool human, int depth)
+/*
+ * Play games of AI against AI, without printing anything, and report how fast
+ * they were played and how they ended. With more than one search thread, the
+ * games are played again with 1, 2, ... threads, to see how the search scales.
+ * Each run starts with an empty transposition table.
+ */
+void selfplay(struct engine *e, int games, int depth_white, int depth_black)
+{
+	struct timespec start, end;
+	double seconds;
+	int results[3];
+	int threads_max, verbosity_saved, i;
+
+	threads_max = threads;
+	for (threads = (threads_max > 1) ? 1 : threads_max; threads <= threads_max; threads++) {
+		results[WHITE] = 0;
+		results[BLACK] = 0;
+		results[EMPTY] = 0;
+		tt_clear(e);
+		verbosity_saved = verbosity;
+		verbosity = VERBOSITY_QUIET;
+		e->nodecount_total = 0;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i = 0; i < games; i++)
+			results[newgame(e, depth_white, depth_black)]++;
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		verbosity = verbosity_saved;
+
+		seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+		if (threads_max > 1)
+			printf("%d thread%s:\n", threads, (threads > 1) ? "s" : "");
+		printf("%d games (depth %d v. %d) in %.3f s: %.1f games/s\n",
+			games, depth_white, depth_black, seconds, games / seconds);
+		printf("%lu nodes: %.0f nodes/s\n", e->nodecount_total,
+			e->nodecount_total / seconds);
+		printf("White (X) wins: %d, Black (O) wins: %d, draws: %d\n",
+			results[WHITE], results[BLACK], results[EMPTY]);
+	}
+	threads = threads_max;
+}
+
+/*
+ * Play a game from the empty board. Each color is played by the AI searching to
+ * the given depth, or by the user if the depth is HUMAN. Return the color that
+ * won, or EMPTY for a draw.
+ */
+int newgame(struct engine *e, int depth_white, int depth_black)
 {
-	struct board_pos pos = {
-		{
-			EMPTY, EMPTY, EMPTY,
-			EMPTY, EMPTY, EMPTY,
-			EMPTY, EMPTY, EMPTY
-		},
-		WHITE
-	};
+	struct board_pos pos;
+	int winner;
+
+	board_reset(&pos);
 
 	/*
 	 * Keep making moves until the board is filled up, or if someone
 	 * wins.
 	 */
+	winner = EMPTY;
 	while (board_empty(&pos)) {
-		make_move(&pos, human, depth);
-		/*
-		 * Swap move order; otherwise, one side will make all the
-		 * moves!
-		 */
-		human = human ? false : true;
+		if (pos.color == WHITE)
+			make_move(e, &pos, depth_white == HUMAN, depth_white);
+		else
+			make_move(e, &pos, depth_black == HUMAN, depth_black);
 
 		if (checkmate(&pos)) {
-			printf("%s wins!\n", (pos.color == WHITE) ? "Black (O)" : "White (X)");
-			printf("%s won the game!", human ? "AI" : "You");
+			/* The color that just moved won. */
+			winner = (pos.color == WHITE) ? BLACK : WHITE;
+			report(VERBOSITY_GAME, "%s wins!\n",
+				(winner == WHITE) ? "White (X)" : "Black (O)");
+			report(VERBOSITY_GAME, "%s won the game!",
+				((winner == WHITE ? depth_white : depth_black) == HUMAN) ? "You" : "AI");
 			break;
 		}
 	}
-	display_board(&pos);
-	if (!checkmate(&pos))
-		printf("Draw!\n");
+	if (verbosity >= VERBOSITY_GAME)
+		display_board(&pos);
+	if (winner == EMPTY)
+		report(VERBOSITY_GAME, "Draw!\n");
+	return winner;
 }
 
 /*
  * Either prompt the user to input a move, or make the AI decide a move, and
  * then execute that move.
  */
-void make_move(struct board_pos *pos, bool human, int depth)
+void make_move(struct engine *e, struct board_pos *pos, bool human, int depth)
 {
-	int move, sq, sq_tentative, best_sq;
+	struct search_result result;
+	struct move_list mlist;
+	const char *name;
+	int move, sq, sq_tentative;
 	if (human) {
 		display_board(pos);
 choose_square:
-		printf("Enter square 0 - 8: ");
-		sq_tentative = getchar();
+		printf("Enter square %c - %c: ", square_names[0],
+			square_names[SQUARES_MAX - 1]);
+		sq_tentative = read_key();
 		printf("\n");
-		switch (sq_tentative) {
-		case '0': sq = 0; break;
-		case '1': sq = 1; break;
-		case '2': sq = 2; break;
-		case '3': sq = 3; break;
-		case '4': sq = 4; break;
-		case '5': sq = 5; break;
-		case '6': sq = 6; break;
-		case '7': sq = 7; break;
-		case '8': sq = 8; break;
-		default: goto choose_square;
-		}
-
-		if (pos->sq[sq] == EMPTY) {
+		name = (sq_tentative > 0) ? strchr(square_names, sq_tentative) : NULL;
+		if (!name || name - square_names >= SQUARES_MAX)
+			goto choose_square;
+		sq = name - square_names;
+
+		if (board_square(pos, sq) == EMPTY) {
 			move = sq;
 		} else {
 			printf("That square is taken.\n");
 			goto choose_square;
 		}
 	} else {
-		printf("Deciding best move... ");
-		best_sq = move_pick(pos, depth);
-		printf("AI chose square %d\n", best_sq);
-		move = best_sq;
+		report(VERBOSITY_GAME, "Deciding best move... ");
+		if (verbosity >= VERBOSITY_SEARCH) {
+			move_generate_all(pos, &mlist);
+			printf("Possible moves: ");
+			display_moves(&mlist);
+		}
+		result = move_pick(e, pos, depth);
+		display_result(&result, depth);
+		if (search_log)
+			log_result(pos, &result, depth);
+		report(VERBOSITY_GAME, "AI chose square %c\n", square_names[result.move]);
+		move = result.move;
 	}
 
 	move_do(pos, move);
 }
 
 /*
- * Select the best possible move for the given position. First generate all
- * legal moves with move_generate(), and get the score of each move. Play the
- * move with the best score for the current color.
+ * Set up an engine for its first search, with the budget of -i and -n and the
+ * shared transposition table.
  */
-int move_pick(struct board_pos *pos, int depth)
+void engine_init(struct engine *e)
 {
-	struct move_list mlist;
-	int move_picked, score_current, score_of_candidate_move, i;
-
-	nodecount = 0;
+	memset(e, 0, sizeof(*e));
+	e->tt = tt;
+	atomic_init(&e->stop_flag, false);
+	atomic_init(&e->hit_flag, false);
+	e->stop = &e->stop_flag;
+	e->budget_hit = &e->hit_flag;
+	e->root_first = MOVE_NONE;
+	e->budget_ms = budget_ms;
+	e->budget_nodes = budget_nodes;
+	order_reset(e);
+}
 
-	/* Generate all possible moves. */
-	move_generate(pos, &mlist);
+/*
+ * Select the best possible move for the given position with move_search(), and
+ * return it with what else we found, for the UI to report. If search_compare
+ * is set, search with both minimax() and alphabeta(), and return the nodecount
+ * of each. If the search would reach the end of every variation (as on the hard
+ * level), the answer is the same as that of perfect play, so we just look it
+ * up in the solution table instead.
+ */
+struct search_result move_pick(struct engine *e, struct board_pos *pos, int depth)
+{
+	struct search_result result;
+	struct timespec start, end;
 
-	/*
-	 * Pick default move, so that if we don't find a move that improves our
-	 * position, we can at least fall back to this move.
-	 */
-	move_picked = mlist.move[0];
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	memset(&result, 0, sizeof(result));
+	result.depth = depth;
+	result.distance = -1;
 
-	printf("Possible moves: ");
-	display_moves(&mlist);
+	/* The root move uses up one ply on top of depth. */
+	if (!search_compare && depth + 1 >= board_empty_count(pos) && solution) {
+		result.move = solution_lookup(pos, &result.score);
+		result.distance = solution_distance(pos);
+		result.lookup = true;
+		assert(result.move != MOVE_NONE);
+		assert(board_square(pos, result.move) == EMPTY);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		result.seconds = (end.tv_sec - start.tv_sec)
+			+ (end.tv_nsec - start.tv_nsec) / 1e9;
+		return result;
+	}
 
 	/*
-	 * Assume that the current position is very bad, and that we need to
-	 * improve our position with the next move. If it's WHITE to move, we
-	 * start out with -INF, and work our way up. If it's BLACK to move, we
-	 * start with INF and try to get the smallest score (most negative
-	 * score).
+	 * Both searches start with an empty transposition table, so that the
+	 * second one does not reuse the work of the first.
 	 */
-	score_current = (pos->color == WHITE) ? -INF : INF;
-
-	for (i = 0; i < mlist.moves; i++) {
-		move_do(pos, mlist.move[i]);
-		score_of_candidate_move = minimax(pos, depth);
-		move_undo(pos, mlist.move[i]);
-		if (pos->color == WHITE) {
-			if (score_of_candidate_move > score_current) {
-				move_picked = mlist.move[i];
-				score_current = score_of_candidate_move;
-			}
-		} else {
-			if (score_of_candidate_move < score_current) {
-				move_picked = mlist.move[i];
-				score_current = score_of_candidate_move;
-			}
-		}
+	if (search_compare) {
+		tt_clear(e);
+		result.move_minimax = move_search(e, pos, depth, SEARCH_MINIMAX,
+			&result.score);
+		result.nodes_minimax = e->stats.nodes;
+		tt_clear(e);
+		result.move = move_search(e, pos, depth, SEARCH_ALPHABETA, &result.score);
+		assert(result.move == result.move_minimax);
+	} else if (e->budget_ms || e->budget_nodes) {
+		result.budget = true;
+		result.move = move_search_deepening(e, pos, depth, search_type,
+			&result.score,
+			&result.depth);
+	} else {
+		result.move = move_search(e, pos, depth, search_type, &result.score);
 	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
 
-	assert(move_picked < SQUARES_MAX);
-	assert(pos->sq[move_picked] == EMPTY);
-	printf("After examining %u nodes, best move is: %d\n", nodecount, move_picked + 1);
-	return move_picked;
+	e->nodecount_total += e->stats.nodes;
+	result.stats = e->stats;
+	result.seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	return result;
+}
+
+/*
+ * Search the given position with the given search algorithm and return the best
+ * move, with its score in *score. e->stats is reset, so after we return it
+ * holds the size of this search (over all threads). The search gets the help
+ * of the thread pool unless another engine has it, in which case it searches
+ * in this thread alone.
+ */
+int move_search(struct engine *e, struct board_pos *pos, int depth, int type, int *score)
+{
+	int move;
+
+	if (threads > 1 && pool_claim(e)) {
+		if (smp_enabled)
+			move = move_search_smp(e, pos, depth, type, score);
+		else
+			move = move_search_parallel(e, pos, depth, type, score);
+		pool_release();
+		return move;
+	}
+
+	memset(&e->stats, 0, sizeof(e->stats));
+	order_reset(e);
+	return root_search(e, pos, depth, type, score);
+}
+
+/*
+ * The search of move_search() in a single thread. First generate all legal
+ * moves with move_generate(), and get the score of each move. Play the move
+ * with the best score for the current color; if several moves have the best
+ * score, play the lowest square of them, whatever order the moves were
+ * searched in.
+ */
+int root_search(struct engine *e, struct board_pos *pos, int depth, int type, int *score)
+{
+	struct move_list mlist;
+	int move_picked, score_current, score_of_candidate_move, move, i;
+	bool tie;
+
+	/*
+	 * Generate all possible moves, and for alpha-beta, sort them, starting
+	 * with the best move of the last search of the position.
+	 */
+	move_generate(pos, &mlist);
+	if (type == SEARCH_ALPHABETA)
+		move_order(e, pos, &mlist,
+			(e->root_first != MOVE_NONE) ? e->root_first : tt_move(e, pos));
+	if (e->order_shift)
+		move_rotate(&mlist, e->order_shift);
+
+	/* We have no move yet; the first move we search becomes the best. */
+	move_picked = MOVE_NONE;
+
+	/*
+	 * Assume that the current position is very bad, and that we need to
+	 * improve our position with the next move. Scores are from the point
+	 * of view of the side to move (see minimax()), so whichever color it
+	 * is, we start out with -INF, and work our way up.
+	 */
+	score_current = -INF;
+
+	for (i = 0; i < mlist.moves; i++) {
+		move = mlist.move[i];
+		/* Would the move be picked if it only ties the best score? */
+		tie = move_picked == MOVE_NONE || move < move_picked;
+		/*
+		 * Once we have found a win with this very move, no other move
+		 * can beat it; there would be no window left to search the rest
+		 * of the moves with. A lower square can still tie it, though.
+		 */
+		if (type == SEARCH_ALPHABETA && !tie && score_current
+			== SCORE_WIN(SQUARES_MAX - board_empty_count(pos) + 1))
+			continue;
+		move_do(pos, move);
+		/*
+		 * For alpha-beta, the best score so far is a bound that the
+		 * candidate move has to beat; anything that cannot beat it is
+		 * pruned early. A lower square only has to match it, so its
+		 * window is one wider, to tell a tie from a worse score.
+		 */
+		if (type == SEARCH_ALPHABETA)
+			score_of_candidate_move = -alphabeta(e, pos, depth, -INF,
+				tie - score_current);
+		else
+			score_of_candidate_move = -minimax(e, pos, depth);
+		move_undo(pos, move);
+		if (score_of_candidate_move > score_current
+			|| (score_of_candidate_move == score_current && tie)) {
+			move_picked = move;
+			score_current = score_of_candidate_move;
+		}
+	}
+
+	assert(move_picked < SQUARES_MAX);
+	assert(board_square(pos, move_picked) == EMPTY);
+	*score = (pos->color == WHITE) ? score_current : -score_current;
+	return move_picked;
+}
+
+/*
+ * Same as move_search(), but the moves of the root position are searched in
+ * parallel by all threads. The best score so far cannot be used to prune the
+ * other root moves, as they are searched at the same time, so every root move
+ * is searched with the full (-INF, INF) window. That way every move gets its
+ * real score, and we pick the same move move_search() does.
+ */
+int move_search_parallel(struct engine *e, struct board_pos *pos, int depth,
+	int type, int *score)
+{
+	struct root_job *job = &e->job;
+	int move_picked, score_current, i;
+
+	job->pos = *pos;
+	move_generate(pos, &job->mlist);
+	if (type == SEARCH_ALPHABETA)
+		move_order(e, pos, &job->mlist,
+			(e->root_first != MOVE_NONE) ? e->root_first : tt_move(e, pos));
+	job->depth = depth;
+	job->type = type;
+	job->smp = false;
+	atomic_store(&job->next, 0);
+	job->running = threads - 1;
+	memset(&job->stats, 0, sizeof(job->stats));
+
+	/* Wake up the pool, and search along with it. */
+	pthread_mutex_lock(&pool_lock);
+	pool_generation++;
+	pthread_cond_broadcast(&pool_wake);
+	pthread_mutex_unlock(&pool_lock);
+
+	pool_search(e, job);
+
+	pthread_mutex_lock(&pool_lock);
+	while (job->running)
+		pthread_cond_wait(&pool_done, &pool_lock);
+	pthread_mutex_unlock(&pool_lock);
+
+	e->stats = job->stats;
+
+	/* Pick the move just like move_search(), lowest square first on a tie. */
+	move_picked = job->mlist.move[0];
+	score_current = job->score[0];
+	for (i = 1; i < job->mlist.moves; i++) {
+		if (job->score[i] > score_current || (job->score[i] == score_current
+			&& job->mlist.move[i] < move_picked)) {
+			move_picked = job->mlist.move[i];
+			score_current = job->score[i];
+		}
+	}
+
+	assert(move_picked < SQUARES_MAX);
+	assert(board_square(pos, move_picked) == EMPTY);
+	*score = (pos->color == WHITE) ? score_current : -score_current;
+	return move_picked;
+}
+
+/*
+ * Same as move_search(), but all threads search the whole position at once
+ * (Lazy SMP). Every thread but ours searches moves in a different order, and
+ * stores what it finds in the shared transposition table, where the other
+ * threads can find it. Our thread searches just as move_search() would, so we
+ * pick the same move, only faster. When we are done, the other threads stop
+ * where they are.
+ */
+int move_search_smp(struct engine *e, struct board_pos *pos, int depth,
+	int type, int *score)
+{
+	struct root_job *job = &e->job;
+	int move_picked;
+
+	job->pos = *pos;
+	job->depth = depth;
+	job->type = type;
+	job->smp = true;
+	job->running = threads - 1;
+	memset(&job->stats, 0, sizeof(job->stats));
+
+	pthread_mutex_lock(&pool_lock);
+	pool_generation++;
+	pthread_cond_broadcast(&pool_wake);
+	pthread_mutex_unlock(&pool_lock);
+
+	memset(&e->stats, 0, sizeof(e->stats));
+	order_reset(e);
+	move_picked = root_search(e, pos, depth, type, score);
+	atomic_store(e->stop, true);
+
+	pthread_mutex_lock(&pool_lock);
+	while (job->running)
+		pthread_cond_wait(&pool_done, &pool_lock);
+	pthread_mutex_unlock(&pool_lock);
+	atomic_store(e->stop, false);
+
+	stats_add(&e->stats, &job->stats);
+	return move_picked;
+}
+
+/*
+ * Search the position with move_search() to depth 0, then to depth 1, and so on
+ * up to depth_max, until a search reaches the end of the game or finds how it
+ * is won or lost (see SCORE_DECIDED()), or we run out of the time (budget_ms)
+ * or nodes (budget_nodes) that we may spend. Return the best move of the
+ * deepest search that got to finish, with its score in *score, and its depth in
+ * *depth_done. Each search starts with the best move of the one before it,
+ * which is most likely still the best move, so that alpha-beta can prune the
+ * other moves sooner. The search to depth 0 is never stopped, so that we always
+ * have a move to play. Like move_search(), we leave the counters of all the
+ * searches in stats.
+ */
+int move_search_deepening(struct engine *e, struct board_pos *pos,
+	int depth_max, int type, int *score, int *depth_done)
+{
+	struct search_stats sum;
+	int move_best, move, score_depth, depth;
+
+	clock_gettime(CLOCK_MONOTONIC, &e->budget_deadline);
+	e->budget_deadline.tv_sec += e->budget_ms / 1000;
+	e->budget_deadline.tv_nsec += (e->budget_ms % 1000) * 1000000;
+	if (e->budget_deadline.tv_nsec >= 1000000000) {
+		e->budget_deadline.tv_sec++;
+		e->budget_deadline.tv_nsec -= 1000000000;
+	}
+	e->deepening_nodes = 0;
+	memset(&sum, 0, sizeof(sum));
+
+	move_best = MOVE_NONE;
+	for (depth = 0; depth <= depth_max; depth++) {
+		e->root_first = move_best;
+		e->budget_active = depth > 0;
+		move = move_search(e, pos, depth, type, &score_depth);
+		e->budget_active = false;
+		stats_add(&sum, &e->stats);
+		e->deepening_nodes = sum.nodes;
+		/* A search that was stopped has no score; forget it. */
+		if (atomic_load(e->budget_hit)) {
+			atomic_store(e->budget_hit, false);
+			atomic_store(e->stop, false);
+			break;
+		}
+		move_best = move;
+		*score = score_depth;
+		*depth_done = depth;
+		/*
+		 * The root move uses up one ply on top of depth. Once a win or
+		 * a loss is in sight, searching deeper only finds the same one,
+		 * as every shorter game was searched.
+		 */
+		if (depth + 1 >= board_empty_count(pos)
+			|| SCORE_DECIDED(score_depth))
+			break;
+	}
+	e->root_first = MOVE_NONE;
+
+	e->stats = sum;
+	return move_best;
+}
+
+/*
+ * Stop all search threads if move_search_deepening() has gone over its budget.
+ * Reading the clock takes much longer than searching a node, so we only do it
+ * every BUDGET_INTERVAL nodes. Each thread counts its own nodes, so with more
+ * than one thread, the node budget holds for each of them.
+ */
+void budget_check(struct engine *e)
+{
+	struct timespec now;
+	bool over;
+
+	over = e->budget_nodes && e->deepening_nodes + e->stats.nodes > e->budget_nodes;
+	if (!over && e->budget_ms && !(e->stats.nodes % BUDGET_INTERVAL)) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		over = now.tv_sec > e->budget_deadline.tv_sec
+			|| (now.tv_sec == e->budget_deadline.tv_sec
+				&& now.tv_nsec >= e->budget_deadline.tv_nsec);
+	}
+	if (over) {
+		atomic_store(e->budget_hit, true);
+		atomic_store(e->stop, true);
+	}
+}
+
+/* Add the counters of add to those of sum. */
+void stats_add(struct search_stats *sum, struct search_stats *add)
+{
+	sum->nodes += add->nodes;
+	sum->tt_hits += add->tt_hits;
+	sum->tt_misses += add->tt_misses;
+	sum->cutoffs += add->cutoffs;
+	sum->cutoffs_first += add->cutoffs_first;
+	sum->checkmates += add->checkmates;
+	sum->evals += add->evals;
+	sum->generates += add->generates;
+	sum->leaves += add->leaves;
+	sum->interior += add->interior;
+	sum->wins += add->wins;
+	sum->draws += add->draws;
+	sum->tt_probes += add->tt_probes;
+}
+
+/*
+ * Take the thread pool for the search of engine e, and return true, unless
+ * there is no pool, or another engine has it.
+ */
+bool pool_claim(struct engine *e)
+{
+	bool claimed;
+
+	pthread_mutex_lock(&pool_lock);
+	claimed = pool_size && !pool_busy;
+	if (claimed) {
+		pool_busy = true;
+		pool_job = &e->job;
+		e->job.engine = e;
+	}
+	pthread_mutex_unlock(&pool_lock);
+	return claimed;
+}
+
+/* Let other engines have the thread pool again. */
+void pool_release()
+{
+	pthread_mutex_lock(&pool_lock);
+	pool_busy = false;
+	pthread_mutex_unlock(&pool_lock);
+}
+
+/* Start count threads that help move_search_parallel() and move_search_smp(). */
+void pool_init(int count)
+{
+	pthread_t thread;
+	intptr_t i;
+
+	pool_size = count;
+	for (i = 1; i <= count; i++) {
+		pthread_create(&thread, NULL, pool_thread, (void *)i);
+		pthread_detach(thread);
+	}
+}
+
+/*
+ * Wait for root jobs, and work on them with an engine of our own if we take
+ * part in them; arg is our number in the pool, from 1 to pool_size.
+ */
+void *pool_thread(void *arg)
+{
+	struct engine helper;
+	struct root_job *job;
+	unsigned int generation = 0;
+	int id = (intptr_t)arg;
+
+	engine_init(&helper);
+	helper.order_shift = id;
+	for (;;) {
+		pthread_mutex_lock(&pool_lock);
+		while (generation == pool_generation)
+			pthread_cond_wait(&pool_wake, &pool_lock);
+		generation = pool_generation;
+		job = pool_job;
+		pthread_mutex_unlock(&pool_lock);
+
+		if (id >= threads)
+			continue;
+
+		pool_search(&helper, job);
+
+		pthread_mutex_lock(&pool_lock);
+		if (!--job->running)
+			pthread_cond_signal(&pool_done);
+		pthread_mutex_unlock(&pool_lock);
+	}
+	return NULL;
+}
+
+/*
+ * Search root moves of the job with engine e on our own copy of the board
+ * (move_do() and move_undo() change it), until there are none left; or for a
+ * Lazy SMP job, search the whole position until it is done, or we are told to
+ * stop. Then add our counters to those of the job. If e is not the engine of
+ * the job, it shares the table, stop flags and budget of that engine.
+ */
+void pool_search(struct engine *e, struct root_job *job)
+{
+	struct board_pos pos;
+	int i, score;
+
+	if (e != job->engine) {
+		e->tt = job->engine->tt;
+		e->stop = job->engine->stop;
+		e->budget_hit = job->engine->budget_hit;
+		e->root_first = job->engine->root_first;
+		e->budget_ms = job->engine->budget_ms;
+		e->budget_nodes = job->engine->budget_nodes;
+		e->budget_active = job->engine->budget_active;
+		e->budget_deadline = job->engine->budget_deadline;
+		e->deepening_nodes = job->engine->deepening_nodes;
+	}
+	memset(&e->stats, 0, sizeof(e->stats));
+	order_reset(e);
+	pos = job->pos;
+	if (job->smp)
+		root_search(e, &pos, job->depth, job->type, &score);
+	while (!job->smp && (i = atomic_fetch_add(&job->next, 1)) < job->mlist.moves) {
+		move_do(&pos, job->mlist.move[i]);
+		if (job->type == SEARCH_ALPHABETA)
+			job->score[i] = -alphabeta(e, &pos, job->depth, -INF, INF);
+		else
+			job->score[i] = -minimax(e, &pos, job->depth);
+		move_undo(&pos, job->mlist.move[i]);
+	}
+
+	pthread_mutex_lock(&pool_lock);
+	stats_add(&job->stats, &e->stats);
+	pthread_mutex_unlock(&pool_lock);
+}
+
+/*
+ * Find the best move and its score for each of count positions, just like
+ * move_pick() would. The positions share the transposition table, so positions
+ * that come up in the searches of several of them are only searched once. If
+ * the game is already over in a position, its move is MOVE_NONE and its score
+ * that of the end of the game.
+ */
+void move_pick_batch(struct engine *e, struct board_pos *pos, int count,
+	int depth, int *moves, int *scores)
+{
+	int i;
+
+#ifdef BITBOARD
+	if (depth == 0) {
+		move_pick_leaves(e, pos, count, moves, scores);
+		return;
+	}
+#endif
+	for (i = 0; i < count; i++) {
+		if (checkmate(&pos[i])) {
+			moves[i] = MOVE_NONE;
+			scores[i] = score_won(&pos[i]);
+		} else if (!board_empty(&pos[i])) {
+			moves[i] = MOVE_NONE;
+			scores[i] = 0;
+		} else if (depth + 1 >= board_empty_count(&pos[i]) && solution) {
+			moves[i] = solution_lookup(&pos[i], &scores[i]);
+		} else {
+			moves[i] = move_search(e, &pos[i], depth, search_type,
+				&scores[i]);
+			e->nodecount_total += e->stats.nodes;
+		}
+	}
+}
+
+#ifdef BITBOARD
+/*
+ * move_pick_batch() to depth 0, where the search only scores the position
+ * after each move with checkmate() and eval(). So we play every move of every
+ * position that goes on, and score all the positions we get with
+ * batch_checkmate() and batch_eval(), BATCH_MAX of them at a time in the batch
+ * of the engine (see leaves_score()). The moves and scores are the same as
+ * with move_search().
+ */
+void move_pick_leaves(struct engine *e, struct board_pos *pos, int count, int *moves,
+	int *scores)
+{
+	struct move_list mlist;
+	int i, j;
+
+	e->batch.count = 0;
+	for (i = 0; i < count; i++) {
+		if (checkmate(&pos[i])) {
+			moves[i] = MOVE_NONE;
+			scores[i] = score_won(&pos[i]);
+			continue;
+		} else if (!board_empty(&pos[i])) {
+			moves[i] = MOVE_NONE;
+			scores[i] = 0;
+			continue;
+		} else if (board_empty_count(&pos[i]) == 1 && solution) {
+			moves[i] = solution_lookup(&pos[i], &scores[i]);
+			continue;
+		}
+
+		/* The scores of the moves are only compared once they are all in. */
+		moves[i] = MOVE_NONE;
+		move_generate(&pos[i], &mlist);
+		for (j = 0; j < mlist.moves; j++) {
+			if (e->batch.count == BATCH_MAX) {
+				leaves_score(e, pos, moves, scores);
+				e->batch.count = 0;
+			}
+			e->owner[e->batch.count] = i;
+			e->move[e->batch.count] = mlist.move[j];
+			move_do(&pos[i], mlist.move[j]);
+			batch_add(&e->batch, &pos[i]);
+			move_undo(&pos[i], mlist.move[j]);
+		}
+		e->nodecount_total += mlist.moves;
+	}
+	leaves_score(e, pos, moves, scores);
+}
+
+/*
+ * Score the positions of the batch of the engine, which come from playing
+ * e->move[i] in pos[e->owner[i]], the way alphabeta() scores them at depth 0,
+ * and keep the best move of each owner in moves[] and scores[]. The moves of
+ * each owner come in the order of move_generate(), lowest square first, so of
+ * the moves with the best score, we keep the lowest one, like root_search().
+ */
+void leaves_score(struct engine *e, struct board_pos *pos, int *moves, int *scores)
+{
+	struct board_batch *batch = &e->batch;
+	int i, owner, score, color;
+
+	batch_checkmate(batch, e->won);
+	batch_eval(batch, e->points);
+	for (i = 0; i < batch->count; i++) {
+		/* The color that played the move, and is not to move after it. */
+		owner = e->owner[i];
+		color = pos[owner].color;
+		if (e->won[i])
+			score = SCORE_WIN(SQUARES_MAX + 1
+				- board_empty_count(&pos[owner]));
+		else if ((batch->ours[i] | batch->theirs[i]) == BOARD_FULL)
+			score = 0;
+		else
+			score = e->points[i];
+		/* From White's point of view. */
+		if (color == BLACK)
+			score = -score;
+		if (moves[owner] == MOVE_NONE
+			|| ((color == WHITE) ? score > scores[owner]
+				: score < scores[owner])) {
+			moves[owner] = e->move[i];
+			scores[owner] = score;
+		}
+	}
+}
+#endif
+
+/*
+ * Answer search requests on standard input until it ends or we get "quit",
+ * one line for each: a board (see board_parse()), the side to move ('x' or
+ * 'o'), and any of depth=, time_ms= and nodes=, which default to -d (as
+ * depth_default), -i and -n. The answer is a line of the form
+ * "move score nodes": the move that move_pick() plays ('-' if the game is
+ * over), its score from White's point of view, and the nodes searched for it
+ * (0 if it was looked up). "clear" empties the transposition table; otherwise
+ * it stays warm from one request to the next, like the solution table. A
+ * request we cannot answer gets a line starting with "error".
+ */
+void serve(struct engine *e, int depth_default)
+{
+	struct search_result result;
+	struct board_pos pos;
+	char line[256];
+	const char *error;
+	int depth;
+
+	while (fgets(line, sizeof(line), stdin)) {
+		line[strcspn(line, "\r\n")] = '\0';
+		if (!line[strspn(line, " \t")])
+			continue;
+		if (!strcmp(line, "quit"))
+			break;
+		if (!strcmp(line, "clear")) {
+			tt_clear(e);
+			printf("ok\n");
+			fflush(stdout);
+			continue;
+		}
+
+		e->budget_ms = budget_ms;
+		e->budget_nodes = budget_nodes;
+		depth = depth_default;
+		error = serve_request(e, line, &pos, &depth);
+		if (error) {
+			printf("error %s\n", error);
+		} else if (checkmate(&pos)) {
+			printf("- %d 0\n", score_won(&pos));
+		} else if (!board_empty(&pos)) {
+			printf("- 0 0\n");
+		} else {
+			result = move_pick(e, &pos, depth);
+			if (search_log)
+				log_result(&pos, &result, depth);
+			printf("%d %d %u\n", result.move, result.score, result.stats.nodes);
+		}
+		/* Whoever sent the request is waiting for the answer. */
+		fflush(stdout);
+	}
+}
+
+/*
+ * Set up the position and depth of a request of serve(), and its budget in the
+ * engine e. Return NULL if the request is good, or else what is wrong with it.
+ */
+const char *serve_request(struct engine *e, char *line, struct board_pos *pos, int *depth)
+{
+	char *token, *end, *save;
+	unsigned long value;
+
+	token = strtok_r(line, " \t", &save);
+	if (!board_parse(pos, token))
+		return "board";
+	token = strtok_r(NULL, " \t", &save);
+	if (!token || strlen(token) != 1 || !strchr("xXoO", *token))
+		return "side";
+	if ((*token == 'x' || *token == 'X') != (pos->color == WHITE))
+		return "side";
+
+	while ((token = strtok_r(NULL, " \t", &save))) {
+		end = strchr(token, '=');
+		if (!end || !isdigit((unsigned char)end[1]))
+			return token;
+		value = strtoul(end + 1, &end, 10);
+		if (*end)
+			return token;
+		if (!strncmp(token, "depth=", 6) && value <= MOVES_MAX)
+			*depth = value;
+		else if (!strncmp(token, "time_ms=", 8) && value <= LONG_MAX)
+			e->budget_ms = value;
+		else if (!strncmp(token, "nodes=", 6))
+			e->budget_nodes = value;
+		else
+			return token;
+	}
+	return NULL;
+}
+
+/*
+ * Play many games against humans at once, on connections to a UNIX socket at
+ * path: each connection is a session, which plays one game at a time (see
+ * session_command() for what clients send). One thread waits for all sessions
+ * at once with epoll, and the searches of the AI go to a pool of session
+ * workers, -j of them, which each search one game at a time in a single
+ * thread. Shallow searches go first, so the easy games never wait for the
+ * hard ones. We only return if we cannot set up the socket, with the exit
+ * status for main().
+ */
+int sessions_serve(const char *path)
+{
+	struct epoll_event ev, events[64];
+	pthread_t thread;
+	uint64_t count;
+	int done[SESSIONS_MAX];
+	int listener, ep, finished, n, i;
+
+	/* Solve the game before the workers need it, with as many threads. */
+	session_workers = threads;
+	solution_ready();
+	threads = 1;
+	listener = session_listen(path);
+	if (listener < 0)
+		return 1;
+	session_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	ep = epoll_create1(EPOLL_CLOEXEC);
+	if (session_event < 0 || ep < 0) {
+		perror("simtic");
+		return 1;
+	}
+	ev.events = EPOLLIN;
+	ev.data.u32 = SESSIONS_MAX;
+	epoll_ctl(ep, EPOLL_CTL_ADD, listener, &ev);
+	ev.data.u32 = SESSIONS_MAX + 1;
+	epoll_ctl(ep, EPOLL_CTL_ADD, session_event, &ev);
+	for (i = 0; i < session_workers; i++) {
+		pthread_create(&thread, NULL, session_worker, NULL);
+		pthread_detach(thread);
+	}
+
+	for (;;) {
+		n = epoll_wait(ep, events, sizeof(events) / sizeof(events[0]), -1);
+		if (n < 0 && errno != EINTR) {
+			perror("simtic");
+			return 1;
+		}
+		for (i = 0; i < n; i++) {
+			if (events[i].data.u32 == SESSIONS_MAX) {
+				session_accept(listener, ep);
+			} else if (events[i].data.u32 == SESSIONS_MAX + 1) {
+				/* Take the searches that are done, and finish them. */
+				if (read(session_event, &count, sizeof(count)) < 0
+					&& errno != EAGAIN)
+					perror("simtic");
+				pthread_mutex_lock(&session_lock);
+				finished = session_finished;
+				memcpy(done, session_done, finished * sizeof(done[0]));
+				session_finished = 0;
+				pthread_mutex_unlock(&session_lock);
+				while (finished)
+					session_finish(done[--finished]);
+			} else {
+				session_read(events[i].data.u32);
+			}
+		}
+	}
+}
+
+/*
+ * Return a socket listening at path, or -1 if we cannot make one. A socket
+ * left at path by an earlier run is replaced.
+ */
+int session_listen(const char *path)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "simtic: %s: path too long\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+	if (!stat(path, &st) && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr))
+		|| listen(fd, SOMAXCONN)) {
+		perror(path);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * Give every new connection a session of its own, until there are
+ * SESSIONS_MAX of them; beyond that, connections are told so and closed.
+ */
+void session_accept(int listener, int ep)
+{
+	struct epoll_event ev;
+	int fd, slot;
+
+	while ((fd = accept(listener, NULL, NULL)) >= 0) {
+		for (slot = 0; slot < SESSIONS_MAX && sessions[slot].used; slot++)
+			;
+		if (slot == SESSIONS_MAX || fcntl(fd, F_SETFL, O_NONBLOCK)) {
+			send(fd, "error full\n", 11, MSG_NOSIGNAL | MSG_DONTWAIT);
+			close(fd);
+			continue;
+		}
+		memset(&sessions[slot], 0, sizeof(sessions[slot]));
+		sessions[slot].used = true;
+		sessions[slot].fd = fd;
+		sessions[slot].state = SESSION_NEW;
+		ev.events = EPOLLIN;
+		ev.data.u32 = slot;
+		epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+	}
+}
+
+/*
+ * Read what the client of a session sent, and carry out every whole line of
+ * it. A client that sends a line longer than SESSION_LINE_MAX is cut off.
+ */
+void session_read(int slot)
+{
+	struct session *s = &sessions[slot];
+	char *end;
+	ssize_t len;
+
+	while (s->fd >= 0) {
+		len = read(s->fd, s->in + s->in_len, SESSION_LINE_MAX - s->in_len);
+		if (len < 0 && errno == EAGAIN)
+			return;
+		if (len <= 0) {
+			session_close(slot);
+			return;
+		}
+		s->in_len += len;
+		while (s->fd >= 0 && (end = memchr(s->in, '\n', s->in_len))) {
+			*end = '\0';
+			session_command(slot, s->in);
+			s->in_len -= end + 1 - s->in;
+			memmove(s->in, end + 1, s->in_len);
+		}
+		if (s->fd >= 0 && s->in_len == SESSION_LINE_MAX) {
+			session_send(slot, "error line too long");
+			session_close(slot);
+		}
+	}
+}
+
+/*
+ * Carry out a line from the client of a session:
+ *
+ *	new LEVEL SIDE	start a game at level e, m or h (as in newgame()), with
+ *			the human playing x (White, who moves first) or o
+ *	move SQUARE	play a square, written as in the game
+ *	quit		close the connection
+ *
+ * Once it is the human's move, or the game is over, the session answers with
+ * "play BOARD MOVE" or "over WINNER BOARD MOVE", where BOARD is written like
+ * the boards of -e, MOVE is the square the AI just played ('-' if it did not
+ * play), and WINNER is x, o or draw. Anything else is answered with a line
+ * that starts with "error".
+ */
+void session_command(int slot, char *line)
+{
+	struct session *s = &sessions[slot];
+	const char *name;
+	char level, side, square;
+
+	line[strcspn(line, "\r")] = '\0';
+	if (!strcmp(line, "quit")) {
+		session_close(slot);
+	} else if (s->state == SESSION_AI) {
+		session_send(slot, "error wait for the move of the AI");
+	} else if (sscanf(line, "new %c %c", &level, &side) == 2) {
+		/* The same depth as the levels of newgame(). */
+		switch (level) {
+		case 'e': s->depth = 1; break;
+		case 'm': s->depth = 3; break;
+		case 'h': s->depth = MOVES_MAX; break;
+		default: session_send(slot, "error level"); return;
+		}
+		if (side != 'x' && side != 'o') {
+			session_send(slot, "error side");
+			return;
+		}
+		s->human = (side == 'x') ? WHITE : BLACK;
+		board_reset(&s->pos);
+		if (s->human == WHITE) {
+			s->state = SESSION_HUMAN;
+			session_reply(slot, MOVE_NONE);
+		} else {
+			session_search(slot);
+		}
+	} else if (sscanf(line, "move %c", &square) == 1) {
+		name = strchr(square_names, square);
+		if (s->state != SESSION_HUMAN) {
+			session_send(slot, "error no game");
+		} else if (!square || !name || name - square_names >= SQUARES_MAX
+			|| board_square(&s->pos, name - square_names) != EMPTY) {
+			session_send(slot, "error square");
+		} else {
+			move_do(&s->pos, name - square_names);
+			if (checkmate(&s->pos) || !board_empty(&s->pos)) {
+				s->state = SESSION_OVER;
+				session_reply(slot, MOVE_NONE);
+			} else {
+				session_search(slot);
+			}
+		}
+	} else {
+		session_send(slot, "error command");
+	}
+}
+
+/* Queue the search for the move of the AI in a session. */
+void session_search(int slot)
+{
+	sessions[slot].state = SESSION_AI;
+	pthread_mutex_lock(&session_lock);
+	sessions[slot].seq = session_seq++;
+	session_push(slot);
+	pthread_cond_signal(&session_wake);
+	pthread_mutex_unlock(&session_lock);
+}
+
+/*
+ * Play the move that a session worker found for the AI, and tell the client.
+ * If the client went away during the search, the session is free again.
+ */
+void session_finish(int slot)
+{
+	struct session *s = &sessions[slot];
+
+	if (s->closed) {
+		s->used = false;
+		return;
+	}
+	if (search_log)
+		log_result(&s->pos, &s->result, s->depth);
+	move_do(&s->pos, s->result.move);
+	if (checkmate(&s->pos) || !board_empty(&s->pos))
+		s->state = SESSION_OVER;
+	else
+		s->state = SESSION_HUMAN;
+	session_reply(slot, s->result.move);
+}
+
+/* Tell the client of a session about its game (see session_command()). */
+void session_reply(int slot, int ai_move)
+{
+	struct session *s = &sessions[slot];
+	char board[BOARD_TEXT], line[SQUARES_MAX + 32];
+	const char *winner;
+
+	/* Only the squares, without the side. */
+	board_write(&s->pos, board);
+	board[SQUARES_MAX] = '\0';
+	if (s->state == SESSION_OVER) {
+		if (checkmate(&s->pos))
+			winner = (s->pos.color == WHITE) ? "o" : "x";
+		else
+			winner = "draw";
+		snprintf(line, sizeof(line), "over %s %s %c", winner, board,
+			(ai_move == MOVE_NONE) ? '-' : square_names[ai_move]);
+	} else {
+		snprintf(line, sizeof(line), "play %s %c", board,
+			(ai_move == MOVE_NONE) ? '-' : square_names[ai_move]);
+	}
+	session_send(slot, line);
+}
+
+/*
+ * Send a line to the client of a session. The answers are short, and a client
+ * only gets one for each line it sends, so a client that does not read them
+ * until its socket is full is cut off instead of making us wait.
+ */
+void session_send(int slot, const char *line)
+{
+	char buf[SESSION_LINE_MAX + 1];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "%s\n", line);
+	if (send(sessions[slot].fd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT) != len)
+		session_close(slot);
+}
+
+/*
+ * Close the connection of a session. If the AI is searching its move, the
+ * session stays taken until session_finish() gets the search back.
+ */
+void session_close(int slot)
+{
+	struct session *s = &sessions[slot];
+
+	close(s->fd);
+	s->fd = -1;
+	if (s->state == SESSION_AI)
+		s->closed = true;
+	else
+		s->used = false;
+}
+
+/*
+ * Search the moves of the AI in the sessions of session_queue, shallowest
+ * first. We take several searches of the same depth at once when there are
+ * enough of them to go around all the workers, and hand them back together.
+ */
+void *session_worker(void *arg)
+{
+	struct engine engine;
+	int batch[SESSION_BATCH];
+	uint64_t one = 1;
+	int count, i;
+
+	(void)arg;
+	engine_init(&engine);
+	for (;;) {
+		pthread_mutex_lock(&session_lock);
+		while (!session_queued)
+			pthread_cond_wait(&session_wake, &session_lock);
+		batch[0] = session_pop();
+		for (count = 1; count < SESSION_BATCH
+			&& session_queued >= count * session_workers
+			&& sessions[session_queue[0]].depth == sessions[batch[0]].depth;
+			count++)
+			batch[count] = session_pop();
+		pthread_mutex_unlock(&session_lock);
+
+		for (i = 0; i < count; i++)
+			sessions[batch[i]].result = move_pick(&engine,
+				&sessions[batch[i]].pos,
+				sessions[batch[i]].depth);
+
+		pthread_mutex_lock(&session_lock);
+		for (i = 0; i < count; i++)
+			session_done[session_finished++] = batch[i];
+		pthread_mutex_unlock(&session_lock);
+		if (write(session_event, &one, sizeof(one)) < 0)
+			perror("simtic");
+	}
+	return NULL;
+}
+
+/* Return true if the search of session a goes before that of session b. */
+bool session_before(int a, int b)
+{
+	if (sessions[a].depth != sessions[b].depth)
+		return sessions[a].depth < sessions[b].depth;
+	return sessions[a].seq < sessions[b].seq;
+}
+
+/* Add a session to the heap of session_queue. */
+void session_push(int slot)
+{
+	int i;
+
+	for (i = session_queued++; i && session_before(slot, session_queue[(i - 1) / 2]);
+		i = (i - 1) / 2)
+		session_queue[i] = session_queue[(i - 1) / 2];
+	session_queue[i] = slot;
+}
+
+/* Take the first session off the heap of session_queue, which must not be empty. */
+int session_pop()
+{
+	int first, last, child, i;
+
+	first = session_queue[0];
+	last = session_queue[--session_queued];
+	for (i = 0; (child = 2 * i + 1) < session_queued; i = child) {
+		if (child + 1 < session_queued
+			&& session_before(session_queue[child + 1], session_queue[child]))
+			child++;
+		if (!session_before(session_queue[child], last))
+			break;
+		session_queue[i] = session_queue[child];
+	}
+	session_queue[i] = last;
+	return first;
+}
+
+/* Boards read by evaluate() before they are searched. */
+#define EVAL_BATCH 4096
+
+/*
+ * Read boards from standard input, one per line (see board_parse()), and print
+ * the best move and its score for each one as a line of the form "move score".
+ * The move is '-' if the game is over, and the score is from White's point of
+ * view, as in minimax(). Lines that are not a legal board are answered with
+ * "invalid". Boards are searched in batches of EVAL_BATCH with
+ * move_pick_batch().
+ */
+void evaluate(struct engine *e, int depth)
+{
+	static struct board_pos pos[EVAL_BATCH];
+	static int moves[EVAL_BATCH], scores[EVAL_BATCH];
+	static bool valid[EVAL_BATCH];
+	char line[64];
+	bool done;
+	int count, i, j;
+
+	done = false;
+	while (!done) {
+		/* Read a batch of boards, keeping the invalid ones out of it. */
+		for (count = 0, i = 0; i < EVAL_BATCH; i++) {
+			if (!fgets(line, sizeof(line), stdin)) {
+				done = true;
+				break;
+			}
+			line[strcspn(line, "\r\n")] = '\0';
+			valid[i] = board_parse(&pos[count], line);
+			if (valid[i])
+				count++;
+		}
+
+		move_pick_batch(e, pos, count, depth, moves, scores);
+
+		for (count = 0, j = 0; j < i; j++) {
+			if (!valid[j])
+				printf("invalid\n");
+			else if (moves[count] == MOVE_NONE)
+				printf("- %d\n", scores[count]);
+			else
+				printf("%d %d\n", moves[count], scores[count]);
+			if (valid[j])
+				count++;
+		}
+	}
+}
+
+/* Positions that bench_kernels() times the line checks on. */
+#define BENCH_POSITIONS 4096
+/* Number of times that bench_kernels() goes over all of them. */
+#define BENCH_ROUNDS 2000
+/*
+ * Runs that bench_time() and bench_batch() split the rounds into: they report
+ * the fastest, so that the first one warms up the caches and the branch
+ * predictor, and a run that was interrupted does not count.
+ */
+#define BENCH_RUNS 5
+/* Random games that bench_positions() plays at most for each position. */
+#define BENCH_TRIES 1000
+/* Times that bench_suite() runs each benchmark, for the spread of its times. */
+#define BENCH_REPEATS 10
+/* Rounds over all positions of each run of a bench_suite() benchmark. */
+#define BENCH_SUITE_ROUNDS 200
+/* Positions that bench_suite() searches, and times it searches each per run. */
+#define BENCH_SEARCHES 16
+#define BENCH_SEARCH_ROUNDS 20
+
+/*
+ * Time checkmate() and eval(), whose lines are compiled in for the size of the
+ * board, against checkmate_generic() and eval_generic(), which look them up in
+ * a table, on positions from random games. Both versions have to agree on
+ * every position. Also time writing the positions as text and as codes and
+ * reading them back, which has to give the same positions.
+ */
+void bench_kernels()
+{
+	static struct board_pos pos[BENCH_POSITIONS];
+#ifdef BITBOARD
+	static struct board_batch batch[BENCH_POSITIONS / BATCH_MAX];
+	int won[BATCH_MAX], points[BATCH_MAX];
+	int j;
+#endif
+	int i;
+
+	srand(1);
+	/* Check that the kernels agree on random games, some of them won. */
+	bench_positions(pos, BENCH_POSITIONS, 0, false);
+	for (i = 0; i < BENCH_POSITIONS; i++) {
+		assert(bench_text(&pos[i]) == bench_code(&pos[i]));
+		assert(bench_text(&pos[i]) == (int)board_pack(&pos[i]));
+	}
+#ifdef BITBOARD
+	for (i = 0; i < BENCH_POSITIONS; i++) {
+		assert(checkmate(&pos[i]) == checkmate_generic(&pos[i]));
+		assert(eval(&pos[i]) == eval_generic(&pos[i]));
+		batch_add(&batch[i / BATCH_MAX], &pos[i]);
+	}
+	for (i = 0; i < BENCH_POSITIONS / BATCH_MAX; i++) {
+		batch_checkmate(&batch[i], won);
+		batch_eval(&batch[i], points);
+		for (j = 0; j < BATCH_MAX; j++) {
+			assert(won[j] == checkmate(&pos[i * BATCH_MAX + j]));
+			assert(points[j] == eval(&pos[i * BATCH_MAX + j]));
+		}
+	}
+#endif
+
+	/*
+	 * Time them on positions that the search would reach: nobody has won
+	 * yet, so that checkmate() has to look at every line.
+	 */
+	bench_positions(pos, BENCH_POSITIONS, 0, true);
+#ifdef BITBOARD
+	memset(batch, 0, sizeof(batch));
+	for (i = 0; i < BENCH_POSITIONS; i++)
+		batch_add(&batch[i / BATCH_MAX], &pos[i]);
+
+	printf("%dx%d board, %d in a row (%d lines), ns per call:\n",
+		BOARD_M, BOARD_N, BOARD_K, LINES_MAX);
+	printf("checkmate(): %.2f, generic: %.2f\n",
+		bench_time(checkmate, pos, BENCH_ROUNDS),
+		bench_time(checkmate_generic, pos, BENCH_ROUNDS));
+	printf("eval(): %.2f, generic: %.2f\n", bench_time(eval, pos, BENCH_ROUNDS),
+		bench_time(eval_generic, pos, BENCH_ROUNDS));
+	printf("batch_checkmate(): %.2f, batch_eval(): %.2f (%d boards per vector)\n",
+		bench_batch(batch_checkmate, batch, BENCH_ROUNDS),
+		bench_batch(batch_eval, batch, BENCH_ROUNDS), BATCH_LANES);
+#else
+	printf("The line checks are only compiled in for bitboards (see the Makefile).\n");
+#endif
+	printf("board_write() and board_read(): %.2f ns, "
+		"board_pack() and board_unpack(): %.2f ns\n",
+		bench_time(bench_text, pos, BENCH_ROUNDS / 10),
+		bench_time(bench_code, pos, BENCH_ROUNDS / 10));
+}
+
+/*
+ * Write the board as text and read it back into a board of our own, and return
+ * the code of that board (see board_pack()).
+ */
+int bench_text(struct board_pos *pos)
+{
+	struct board_pos copy;
+	char buf[BOARD_TEXT];
+
+	board_write(pos, buf);
+	if (board_read(&copy, buf) != buf + BOARD_TEXT)
+		return -1;
+	return board_pack(&copy);
+}
+
+/* The same as bench_text(), with the code of the board instead of its text. */
+int bench_code(struct board_pos *pos)
+{
+	struct board_pos copy;
+
+	if (!board_unpack(&copy, board_pack(pos)))
+		return -1;
+	return board_pack(&copy);
+}
+
+/*
+ * Time solution_build() with 1 thread, 2 threads, and so on up to -j, on a
+ * table of our own, and check that they all solve the same table.
+ */
+void bench_solve()
+{
+	struct timespec start, end;
+	uint16_t *table;
+	uint32_t checksum;
+	int count;
+
+	if (!solution_enabled)
+		return;
+	table = malloc(SOLUTION_SIZE * sizeof(*table));
+	if (!table) {
+		fprintf(stderr, "simtic: no memory for the perfect play table\n");
+		return;
+	}
+	solution = table;
+	checksum = 0;
+	for (count = 1; count <= threads; count++) {
+		memset(table, 0, SOLUTION_SIZE * sizeof(*table));
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		solution_build(count);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		if (count == 1)
+			checksum = solution_checksum(table, SOLUTION_SIZE);
+		assert(solution_checksum(table, SOLUTION_SIZE) == checksum);
+		printf("solution_build(): %.3f s with %d thread%s\n",
+			(end.tv_sec - start.tv_sec)
+				+ (end.tv_nsec - start.tv_nsec) / 1e9,
+			count, (count == 1) ? "" : "s");
+	}
+	solution = NULL;
+	free(table);
+}
+
+/*
+ * Return the average time in nanoseconds that kernel takes on each of the
+ * BENCH_POSITIONS positions of pos, going over all of them rounds times, in
+ * the fastest of BENCH_RUNS runs.
+ */
+double bench_time(int (*kernel)(struct board_pos *), struct board_pos *pos, int rounds)
+{
+	struct timespec start, end;
+	volatile int sink;
+	double ns, best;
+	int run, round, sum, i;
+
+	sum = 0;
+	best = 0;
+	for (run = 0; run < BENCH_RUNS; run++) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (round = 0; round < rounds / BENCH_RUNS; round++) {
+			for (i = 0; i < BENCH_POSITIONS; i++)
+				sum += kernel(&pos[i]);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+		if (!run || ns < best)
+			best = ns;
+	}
+	/* Keep the compiler from dropping the calls. */
+	sink = sum;
+	(void)sink;
+	return best / ((double)(rounds / BENCH_RUNS) * BENCH_POSITIONS);
+}
+
+#ifdef BITBOARD
+/*
+ * The same as bench_time(), for a batch kernel on the BENCH_POSITIONS
+ * positions of the batches (BATCH_MAX in each): the time per position.
+ */
+double bench_batch(void (*kernel)(struct board_batch *, int *), struct board_batch *batch,
+	int rounds)
+{
+	static int out[BATCH_MAX];
+	struct timespec start, end;
+	volatile int sink;
+	double ns, best;
+	int run, round, sum, i;
+
+	sum = 0;
+	best = 0;
+	for (run = 0; run < BENCH_RUNS; run++) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (round = 0; round < rounds / BENCH_RUNS; round++) {
+			for (i = 0; i < BENCH_POSITIONS / BATCH_MAX; i++) {
+				kernel(&batch[i], out);
+				sum += out[round % BATCH_MAX];
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+		if (!run || ns < best)
+			best = ns;
+	}
+	sink = sum;
+	(void)sink;
+	return best / ((double)(rounds / BENCH_RUNS) * BENCH_POSITIONS);
+}
+#endif
+
+/*
+ * Fill pos with count positions from random games of plies_min up to
+ * SQUARES_MAX - 1 moves, which stop early if the game is over; the same ones
+ * for the same seed of srand(). If open is set, the game must go on in every
+ * position, so games that end too soon are played again, up to BENCH_TRIES
+ * times for each position. Return the number of positions we found.
+ */
+int bench_positions(struct board_pos *pos, int count, int plies_min, bool open)
+{
+	struct move_list mlist;
+	int i, plies, tries;
+
+	for (i = 0; i < count; i++) {
+		for (tries = 0; tries < BENCH_TRIES; tries++) {
+			board_reset(&pos[i]);
+			plies = plies_min + rand() % (SQUARES_MAX - plies_min);
+			while (plies-- && board_empty(&pos[i]) && !checkmate(&pos[i])) {
+				move_generate_all(&pos[i], &mlist);
+				move_do(&pos[i], mlist.move[rand() % mlist.moves]);
+			}
+			if (!open || (board_empty(&pos[i]) && !checkmate(&pos[i])))
+				break;
+		}
+		if (tries == BENCH_TRIES)
+			return i;
+	}
+	return count;
+}
+
+#ifdef BENCH
+/*
+ * Run every benchmark of the benchmark binary (see the Makefile) BENCH_REPEATS
+ * times, and report the mean time of each operation, its standard deviation
+ * over the runs, and its fastest run. The positions come from random games with
+ * a fixed seed, and every search starts with an empty transposition table, so
+ * the work done is the same on every run of the same build: searches report
+ * the same nodes per operation every time. The positions that are searched
+ * have at most 9 empty squares, so that a search to depth 9 reaches the end of
+ * the game on any board. move_pick() always searches, instead of looking up
+ * perfect play.
+ */
+void bench_suite(struct engine *e)
+{
+	static struct board_pos pos[BENCH_POSITIONS];
+	static const int depths[] = {1, 3, 9};
+	double ns[BENCH_REPEATS];
+	unsigned long nodes;
+	char name[32];
+	int searches, r, d;
+
+	printf("%dx%d board, %d in a row, %s, gcc %s\n", BOARD_M, BOARD_N, BOARD_K,
+#ifdef BITBOARD
+		"bitboards",
+#else
+		"arrays",
+#endif
+		__VERSION__);
+	printf("board_pos: %zu bytes, move_list: %zu bytes\n", sizeof(struct board_pos),
+		sizeof(struct move_list));
+	printf("%-22s %10s %10s %10s %12s %12s\n", "benchmark", "ns/op", "stddev", "min",
+		"nodes/op", "nodes/s");
+
+	/*
+	 * Each benchmark is run once more before the runs we count, as r = -1,
+	 * to warm up the caches; run 0 overwrites its time.
+	 */
+	srand(1);
+	bench_positions(pos, BENCH_POSITIONS, 0, false);
+	for (r = -1; r < BENCH_REPEATS; r++)
+		ns[(r < 0) ? 0 : r] = bench_time(checkmate, pos, BENCH_SUITE_ROUNDS);
+	bench_report("checkmate()", ns, 0);
+	for (r = -1; r < BENCH_REPEATS; r++)
+		ns[(r < 0) ? 0 : r] = bench_time(eval, pos, BENCH_SUITE_ROUNDS);
+	bench_report("eval()", ns, 0);
+	for (r = -1; r < BENCH_REPEATS; r++)
+		ns[(r < 0) ? 0 : r] = bench_time(bench_generate, pos, BENCH_SUITE_ROUNDS);
+	bench_report("move_generate()", ns, 0);
+	for (r = -1; r < BENCH_REPEATS; r++)
+		ns[(r < 0) ? 0 : r] = bench_do_undo(pos);
+	bench_report("move_do()/move_undo()", ns, 0);
+
+	searches = bench_positions(pos, BENCH_SEARCHES,
+		(SQUARES_MAX > 9) ? SQUARES_MAX - 9 : 0, true);
+	if (searches < BENCH_SEARCHES) {
+		printf("Random games end too soon on this board to search them.\n");
+		return;
+	}
+	solution_enabled = false;
+	for (d = 0; d < (int)(sizeof(depths) / sizeof(depths[0])); d++) {
+		for (r = -1; r < BENCH_REPEATS; r++)
+			ns[(r < 0) ? 0 : r] = bench_search(e, pos, searches,
+				depths[d], false,
+				&nodes);
+		snprintf(name, sizeof(name), "minimax() depth %d", depths[d]);
+		bench_report(name, ns, (double)nodes / searches);
+	}
+	for (r = -1; r < BENCH_REPEATS; r++)
+		ns[(r < 0) ? 0 : r] = bench_search(e, pos, searches, 9, true, &nodes);
+	bench_report("move_pick() depth 9", ns, (double)nodes / searches);
+}
+
+/* Generate the moves of pos, for bench_time(). */
+int bench_generate(struct board_pos *pos)
+{
+	struct move_list mlist;
+
+	move_generate(pos, &mlist);
+	return mlist.moves;
+}
+
+/*
+ * Return the average time in nanoseconds of a move_do() and move_undo() of a
+ * move, over all moves of each of the BENCH_POSITIONS positions of pos, going
+ * over all of them BENCH_SUITE_ROUNDS times.
+ */
+double bench_do_undo(struct board_pos *pos)
+{
+	static struct move_list mlist[BENCH_POSITIONS];
+	struct timespec start, end;
+	unsigned long pairs;
+	int round, i, j;
+
+	for (i = 0; i < BENCH_POSITIONS; i++)
+		move_generate_all(&pos[i], &mlist[i]);
+	pairs = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (round = 0; round < BENCH_SUITE_ROUNDS; round++) {
+		for (i = 0; i < BENCH_POSITIONS; i++) {
+			for (j = 0; j < mlist[i].moves; j++) {
+				move_do(&pos[i], mlist[i].move[j]);
+				/* Keep the compiler from merging the two into nothing. */
+				__asm__ volatile("" ::: "memory");
+				move_undo(&pos[i], mlist[i].move[j]);
+			}
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	for (i = 0; i < BENCH_POSITIONS; i++)
+		pairs += mlist[i].moves;
+	return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec))
+		/ ((double)pairs * BENCH_SUITE_ROUNDS);
+}
+
+/*
+ * Return the average time in nanoseconds that minimax() (or move_pick(), if
+ * pick is set) takes to search each of the count positions of pos to depth,
+ * each with an empty transposition table, over BENCH_SEARCH_ROUNDS searches of
+ * each; the nodes of one search of each position go into *nodes.
+ */
+double bench_search(struct engine *e, struct board_pos *pos, int count,
+	int depth, bool pick, unsigned long *nodes)
+{
+	struct timespec start, end;
+	double ns;
+	int i;
+
+	ns = 0;
+	*nodes = 0;
+	for (i = 0; i < count * BENCH_SEARCH_ROUNDS; i++) {
+		tt_clear(e);
+		e->stats.nodes = 0;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (pick)
+			move_pick(e, &pos[i % count], depth);
+		else
+			minimax(e, &pos[i % count], depth);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		ns += (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+		if (i < count)
+			*nodes += e->stats.nodes;
+	}
+	return ns / (count * BENCH_SEARCH_ROUNDS);
+}
+
+/*
+ * Print the mean, standard deviation and minimum of the BENCH_REPEATS times in
+ * ns of the benchmark name, and for searches, the nodes each one examined and
+ * the nodes per second at the mean time.
+ */
+void bench_report(const char *name, double *ns, double nodes)
+{
+	double mean, var, min;
+	int r;
+
+	mean = 0;
+	min = ns[0];
+	for (r = 0; r < BENCH_REPEATS; r++) {
+		mean += ns[r] / BENCH_REPEATS;
+		if (ns[r] < min)
+			min = ns[r];
+	}
+	var = 0;
+	for (r = 0; r < BENCH_REPEATS; r++)
+		var += (ns[r] - mean) * (ns[r] - mean) / (BENCH_REPEATS - 1);
+	printf("%-22s %10.2f %10.2f %10.2f", name, mean, sqrt(var), min);
+	if (nodes)
+		printf(" %12.1f %12.0f", nodes, nodes / mean * 1e9);
+	printf("\n");
+}
+#endif
+
+/*
+ * Read boards from standard input as evaluate() does, and print what perft()
+ * finds for each of them to the given depth (or to the end of the game, if that
+ * comes first), with how long it took.
+ */
+void perft_boards(int depth)
+{
+	struct board_pos pos;
+	char line[64];
+
+	while (fgets(line, sizeof(line), stdin)) {
+		line[strcspn(line, "\r\n")] = '\0';
+		if (!board_parse(&pos, line)) {
+			printf("invalid\n");
+			continue;
+		}
+		printf("%s:\n", line);
+		perft_report(&pos, depth);
+	}
+}
+
+/*
+ * Print the number of positions perft() reaches at every ply of the move tree of
+ * pos, how many of them end the game, and the branching factor: the number of
+ * positions at the ply over the number of positions one ply up where the game
+ * goes on. The last ply is counted without playing its moves, so whether they
+ * end the game is not known there.
+ */
+void perft_report(struct board_pos *pos, int depth)
+{
+	struct perft_counts counts;
+	struct timespec start, end;
+	unsigned long total;
+	double seconds;
+	int ply;
+
+	if (checkmate(pos) || !board_empty(pos)) {
+		printf("game over\n");
+		return;
+	}
+	if (depth > board_empty_count(pos))
+		depth = board_empty_count(pos);
+
+	memset(&counts, 0, sizeof(counts));
+	counts.nodes[0] = 1;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	perft(pos, depth, 0, &counts);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	printf("%4s %14s %14s %14s %9s\n", "ply", "nodes", "wins", "draws", "branching");
+	total = 0;
+	for (ply = 1; ply <= depth; ply++) {
+		total += counts.nodes[ply];
+		printf("%4d %14lu ", ply, counts.nodes[ply]);
+		if (ply < depth)
+			printf("%14lu %14lu ", counts.wins[ply], counts.draws[ply]);
+		else
+			printf("%14s %14s ", "-", "-");
+		printf("%9.2f\n", (double)counts.nodes[ply] / (counts.nodes[ply - 1]
+			- counts.wins[ply - 1] - counts.draws[ply - 1]));
+	}
+	printf("%lu nodes in %.3f s: %.0f nodes/s\n", total, seconds, total / seconds);
+}
+
+/*
+ * Count the positions of the move tree of pos, depth moves deep, into counts,
+ * ply being the ply of pos. Positions where the game is over are counted, but
+ * not played on. At the last ply, the moves are counted without playing them
+ * (bulk counting), which is where most of the positions are.
+ */
+void perft(struct board_pos *pos, int depth, int ply, struct perft_counts *counts)
+{
+	struct move_list mlist;
+	int i;
+
+	move_generate_all(pos, &mlist);
+	if (depth == 1) {
+		counts->nodes[ply + 1] += mlist.moves;
+		return;
+	}
+	for (i = 0; i < mlist.moves; i++) {
+		move_do(pos, mlist.move[i]);
+		counts->nodes[ply + 1]++;
+		if (checkmate(pos))
+			counts->wins[ply + 1]++;
+		else if (!board_empty(pos))
+			counts->draws[ply + 1]++;
+		else
+			perft(pos, depth - 1, ply + 1, counts);
+		move_undo(pos, mlist.move[i]);
+	}
+}
+
+/*
+ * Return true if the solution table can be used, solving it with
+ * solution_init() the first time (which takes about a second on a 4x4 board).
+ * Only call it before any engine searches: searches only use the table if it
+ * is already there.
+ */
+bool solution_ready()
+{
+	if (solution_enabled && !solution)
+		solution_init();
+	return solution_enabled;
+}
+
+/*
+ * Solve every position by retrograde analysis (see solution_build()). If there
+ * is not enough memory for the solution table, we go without it. With a
+ * solution file (-r), we map the table from the file if it is up to date, and
+ * otherwise solve it and save it there for next time.
+ */
+void solution_init()
+{
+	if (solution_path && solution_map(solution_path))
+		return;
+	solution = calloc(SOLUTION_SIZE, sizeof(*solution));
+	if (!solution) {
+		fprintf(stderr, "simtic: no memory for the perfect play table\n");
+		solution_enabled = false;
+		return;
+	}
+	solution_build(threads);
+	if (solution_path)
+		solution_save(solution_path);
+}
+
+/*
+ * Fill in the solution table with count threads. Instead of searching down
+ * from the empty board, solve the positions layer by layer, from the full
+ * boards down to the empty one: a move adds a piece, so the positions after
+ * every move of a position are all in the layer solved before it. Within a
+ * layer, positions only read the layer above, so the threads solve the chunks
+ * of the layer at the same time without locks, and we wait for all of them
+ * before we go on to the next layer. Positions that cannot come up in a game
+ * (where one color has too many pieces) are left unsolved.
+ */
+void solution_build(int count)
+{
+	struct solution_layer layer;
+	pthread_t helpers[THREADS_MAX];
+	int i;
+
+	for (layer.ply = SQUARES_MAX; layer.ply >= 0; layer.ply--) {
+		atomic_init(&layer.next, 0);
+		for (i = 1; i < count; i++)
+			pthread_create(&helpers[i], NULL, solution_worker,
+				&layer);
+		solution_worker(&layer);
+		for (i = 1; i < count; i++)
+			pthread_join(helpers[i], NULL);
+	}
+}
+
+/*
+ * Solve the chunks of the layer arg (a struct solution_layer) until there are
+ * none left: put the pieces of the chunk on the highest squares, and fill in
+ * the rest of the pieces of the layer below them. White has moved as often as
+ * Black, or once more.
+ */
+void *solution_worker(void *arg)
+{
+	struct solution_layer *layer = arg;
+	struct board_pos pos;
+	int pieces[2], low, chunk, digit, sq;
+
+	/* The lowest square of the chunk. */
+	low = SQUARES_MAX - SOLUTION_SPLIT;
+	while ((chunk = atomic_fetch_add(&layer->next, 1)) < (int)pow3[SOLUTION_SPLIT]) {
+		board_reset(&pos);
+		pieces[WHITE] = (layer->ply + 1) / 2;
+		pieces[BLACK] = layer->ply / 2;
+		/* The number of the chunk is its squares in base 3. */
+		for (sq = low; sq < SQUARES_MAX; sq++) {
+			digit = chunk / pow3[sq - low] % 3;
+			if (digit) {
+				pos.color = digit - 1;
+				move_do(&pos, sq);
+				pieces[digit - 1]--;
+			}
+		}
+		if (pieces[WHITE] >= 0 && pieces[BLACK] >= 0)
+			solution_fill(&pos, low, pieces[WHITE], pieces[BLACK]);
+	}
+	return NULL;
+}
+
+/*
+ * Solve every position that we get by putting white more White pieces and black
+ * more Black pieces on the squares below sq of pos, which are empty.
+ */
+void solution_fill(struct board_pos *pos, int sq, int white, int black)
+{
+	if (white + black > sq)
+		return;
+	if (!sq) {
+		/* White is to move whenever both colors have as many pieces. */
+		pos->color = (board_empty_count(pos) % 2 == SQUARES_MAX % 2)
+			? WHITE : BLACK;
+#ifndef BITBOARD
+		pos->last = MOVE_NONE;
+#endif
+		solution[pos->index[0]] = solution_solve(pos);
+		return;
+	}
+
+	sq--;
+	solution_fill(pos, sq, white, black);
+	if (white) {
+		pos->color = WHITE;
+		move_do(pos, sq);
+		solution_fill(pos, sq, white - 1, black);
+		pos->color = BLACK;
+		move_undo(pos, sq);
+	}
+	if (black) {
+		pos->color = BLACK;
+		move_do(pos, sq);
+		solution_fill(pos, sq, white, black - 1);
+		pos->color = WHITE;
+		move_undo(pos, sq);
+	}
+}
+
+/*
+ * Map the solution table from the file at path, read-only, and return true if
+ * it is up to date: the header has to be the one that solution_save() would
+ * write now, and the entries have to add up to its checksum. All processes
+ * that map the same file share one copy of it in the page cache. A missing
+ * file is solved quietly; any other file that we cannot use is reported.
+ */
+bool solution_map(const char *path)
+{
+	struct solution_header header, *file;
+	struct stat st;
+	size_t size;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	size = sizeof(header) + SOLUTION_SIZE * sizeof(*solution);
+	if (fstat(fd, &st) || (size_t)st.st_size != size) {
+		close(fd);
+		fprintf(stderr, "simtic: %s is not a solution file of this board, solving again\n",
+			path);
+		return false;
+	}
+	map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror(path);
+		return false;
+	}
+
+	file = map;
+	solution_header_init(&header);
+	header.checksum = file->checksum;
+	if (memcmp(&header, file, sizeof(header))
+		|| solution_checksum((uint16_t *)(file + 1), SOLUTION_SIZE) != file->checksum) {
+		munmap(map, size);
+		fprintf(stderr, "simtic: %s is out of date, solving again\n", path);
+		return false;
+	}
+	solution = (uint16_t *)(file + 1);
+	return true;
+}
+
+/*
+ * Write the solution table to the file at path, with its header. The table
+ * goes to a temporary file first, which then replaces the file at path, so
+ * that other processes never map a file that is only partly written. If we
+ * cannot write it, we go on without it.
+ */
+void solution_save(const char *path)
+{
+	struct solution_header header;
+	char tmp[4096];
+	FILE *fp;
+	bool ok;
+	int fd;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp)) {
+		fprintf(stderr, "simtic: %s: path too long\n", path);
+		return;
+	}
+	fd = mkstemp(tmp);
+	if (fd < 0 || !(fp = fdopen(fd, "wb"))) {
+		perror(tmp);
+		if (fd >= 0) {
+			close(fd);
+			unlink(tmp);
+		}
+		return;
+	}
+	solution_header_init(&header);
+	header.checksum = solution_checksum(solution, SOLUTION_SIZE);
+	ok = fwrite(&header, sizeof(header), 1, fp) == 1
+		&& fwrite(solution, sizeof(*solution), SOLUTION_SIZE, fp) == SOLUTION_SIZE;
+	/* mkstemp() makes the file private; the table is for everyone. */
+	ok = !fchmod(fd, 0644) && ok;
+	ok = !fclose(fp) && ok;
+	if (!ok || rename(tmp, path)) {
+		perror(path);
+		unlink(tmp);
+	}
+}
+
+/* Fill in the header of a solution file of this build, except the checksum. */
+void solution_header_init(struct solution_header *header)
+{
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, SOLUTION_MAGIC, sizeof(header->magic));
+	header->version = SOLUTION_VERSION;
+	header->order = SOLUTION_ORDER;
+	header->board[0] = BOARD_M;
+	header->board[1] = BOARD_N;
+	header->board[2] = BOARD_K;
+	header->board[3] = sizeof(*solution);
+	header->entries = SOLUTION_SIZE;
+}
+
+/* Return the FNV-1a hash of the entries, one entry at a time. */
+uint32_t solution_checksum(const uint16_t *entries, size_t count)
+{
+	uint32_t hash;
+	size_t i;
+
+	hash = 2166136261u;
+	for (i = 0; i < count; i++)
+		hash = (hash ^ entries[i]) * 16777619u;
+	return hash;
+}
+
+/*
+ * Return the best move of the position under perfect play (MOVE_NONE if the
+ * game is over), and put its score in *score, as minimax() would score it.
+ */
+int solution_lookup(struct board_pos *pos, int *score)
+{
+	unsigned int entry;
+	int ply;
+
+	entry = solution[pos->index[0]];
+	assert(entry & SOLVED);
+	/* The pieces on the board when the game ends. */
+	ply = SQUARES_MAX - board_empty_count(pos) + SOLVED_DISTANCE(entry);
+	switch (SOLVED_RESULT(entry)) {
+	case SOLVED_WHITE: *score = SCORE_WIN(ply); break;
+	case SOLVED_BLACK: *score = -SCORE_WIN(ply); break;
+	default: *score = 0; break;
+	}
+	return SOLVED_MOVE(entry);
+}
+
+/*
+ * Return the number of moves until the game ends under perfect play: the color
+ * that wins wins as soon as it can, and the color that loses loses as late as
+ * it can. A drawn game goes on until the board is full.
+ */
+int solution_distance(struct board_pos *pos)
+{
+	assert(solution[pos->index[0]] & SOLVED);
+	return SOLVED_DISTANCE(solution[pos->index[0]]);
+}
+
+/*
+ * Return the solution table entry of the position, from the entries of the
+ * positions after each move, which have to be solved already (see
+ * solution_init()). The best move is the one with the best result that wins
+ * the soonest, or loses the latest; the lowest square of them if several do.
+ * That is also what move_search() picks, as its scores tell how soon the game
+ * is won (see SCORE_WIN()).
+ */
+unsigned int solution_solve(struct board_pos *pos)
+{
+	unsigned int entry;
+	int rank, rank_best, distance, left, move, result, sq;
+
+	if (checkmate(pos))
+		return SOLVED_ENTRY((pos->color == WHITE) ? SOLVED_BLACK : SOLVED_WHITE,
+			0, MOVE_NONE);
+	if (!board_empty(pos))
+		return SOLVED_ENTRY(SOLVED_DRAW, 0, MOVE_NONE);
+
+	/* Rank the results for the color to move: loss 0, draw 1, win 2. */
+	rank_best = -1;
+	distance = 0;
+	move = MOVE_NONE;
+	result = SOLVED_DRAW;
+	for (sq = 0; sq < SQUARES_MAX; sq++) {
+		if (board_square(pos, sq) != EMPTY)
+			continue;
+		entry = solution[pos->index[0] + (pos->color + 1) * pow3[sq]];
+		assert(entry & SOLVED);
+		if (SOLVED_RESULT(entry) == SOLVED_DRAW)
+			rank = 1;
+		else if (SOLVED_RESULT(entry) == ((pos->color == WHITE) ? SOLVED_WHITE : SOLVED_BLACK))
+			rank = 2;
+		else
+			rank = 0;
+		/*
+		 * Win sooner, or lose later; a draw always fills the board. left
+		 * is the number of moves until the game ends after this one.
+		 */
+		left = (int)SOLVED_DISTANCE(entry) + 1;
+		if (rank > rank_best || (rank == rank_best
+			&& ((rank == 2) ? left < distance : left > distance))) {
+			rank_best = rank;
+			move = sq;
+			result = SOLVED_RESULT(entry);
+			distance = left;
+		}
+	}
+	return SOLVED_ENTRY(result, distance, move);
 }
 
 /*
@@ -325,135 +3310,897 @@ int move_pick(struct board_pos *pos, int depth)
  * just moved has won the game. We return 0 otherwise. The chess equivalent is
  * determining if it is checkmate for a given side. We always call this function
  * first, because if there is a won condition, it does not make any sense to
- * keep evaluating past that point.
+ * keep evaluating past that point. With bitboards, a board with few lines
+ * (see CHECKMATE_LOOP_LINES) has them checked one by one, and any other has
+ * every line checked at once with a few shifts (see line_run()). Otherwise, if we know the last move
+ * (see board_pos.last), only the lines through it can have just been
+ * completed, so we only check those.
+ */
+#ifdef BITBOARD
+int checkmate(struct board_pos *pos)
+{
+	bitboard_t player;
+#if LINES_MAX <= CHECKMATE_LOOP_LINES
+	int i;
+#endif
+
+	/*
+	 * Get the pieces of the color that just played the last move (the
+	 * opposite of the current color).
+	 */
+	player = pos->bb[(pos->color == WHITE) ? BLACK : WHITE];
+#if LINES_MAX <= CHECKMATE_LOOP_LINES
+	/*
+	 * Check each line in turn for a square that we do not have. The masks
+	 * are constants, so the loop is unrolled into one test per line.
+	 */
+#pragma GCC unroll 128
+	for (i = 0; i < LINES_MAX; i++) {
+		if (!(~player & winning_masks[i]))
+			return 1;
+	}
+	return 0;
+#else
+	/* Check the lines in all four directions at once. */
+	return (line_run(player, 1, STARTS_ROW)
+		| line_run(player, BOARD_N, STARTS_COL)
+		| line_run(player, BOARD_N + 1, STARTS_DIAG)
+		| line_run(player, BOARD_N - 1, STARTS_ANTI)) != 0;
+#endif
+}
+
+/*
+ * Return the squares of starts that begin a line of pieces going step squares
+ * at a time. Shifting the pieces down by step lines up every square with the
+ * next square of its line, so after BOARD_K - 1 shifts, only the squares that
+ * begin a whole line of pieces are left. Lines that would run off the edge of
+ * the board are not in starts.
+ */
+bitboard_t line_run(bitboard_t pieces, int step, bitboard_t starts)
+{
+	bitboard_t run;
+	int i;
+	run = pieces & starts;
+	for (i = 1; i < BOARD_K; i++)
+		run &= pieces >> (i * step);
+	return run;
+}
+
+/*
+ * The same as checkmate(), but looking the lines up in line_masks[], as if we
+ * did not know the size of the board when compiling.
+ */
+int checkmate_generic(struct board_pos *pos)
+{
+	int i;
+	bitboard_t player;
+	player = pos->bb[(pos->color == WHITE) ? BLACK : WHITE];
+	for (i = 0; i < LINES_MAX; i++) {
+		if ((player & line_masks[i]) == line_masks[i])
+			return 1;
+	}
+	return 0;
+}
+#else
+int checkmate(struct board_pos *pos)
+{
+	const int *line;
+	int i, player_color;
+
+	/*
+	 * Get the color that just played the last move (the opposite of the
+	 * current color).
+	 */
+	player_color = (pos->color == WHITE) ? BLACK : WHITE;
+	if (pos->last != MOVE_NONE) {
+		for (line = square_lines[pos->last]; *line != -1; line++) {
+			if (pos->lines[player_color][*line] == BOARD_K)
+				return 1;
+		}
+		return 0;
+	}
+	/* Check each won condition. */
+	for (i = 0; i < LINES_MAX; i++) {
+		/* If we have a full line, then yes, somebody won the game! */
+		if (pos->lines[player_color][i] == BOARD_K)
+			return 1;
+	}
+
+	/* Nobody won the game so far. */
+	return 0;
+}
+#endif
+
+/*
+ * Examine the position, and return a score based on how many possible
+ * k-in-a-row opportunities there are. The higher the score, the more
+ * opportunities. This function is very similar to checkmate(), because of the
+ * simplicity of the game.
+ */
+#ifdef BITBOARD
+int eval(struct board_pos *pos)
+{
+	int i, points;
+	bitboard_t ours, enemy, empty;
+
+	points = 0;
+	ours = pos->bb[pos->color];
+	enemy = pos->bb[(pos->color == WHITE) ? BLACK : WHITE];
+	empty = ~(ours | enemy) & BOARD_FULL;
+	/*
+	 * Check each row, column, and diagonal for winning chances. The masks
+	 * are constants, so the loop is unrolled into one check per line.
+	 */
+#pragma GCC unroll 128
+	for (i = 0; i < LINES_MAX; i++) {
+		/*
+		 * If we have all but one of our own lined up, count the empty
+		 * squares on the line for us, and the enemy's pieces against
+		 * us.
+		 */
+		if (__builtin_popcountll(ours & winning_masks[i]) >= BOARD_K - 1) {
+			points += __builtin_popcountll(empty & winning_masks[i]);
+			points -= __builtin_popcountll(enemy & winning_masks[i]);
+		}
+	}
+
+	return points;
+}
+
+/* The same as eval(), but looking the lines up in line_masks[]. */
+int eval_generic(struct board_pos *pos)
+{
+	int i, points;
+	bitboard_t ours, enemy, empty;
+	points = 0;
+	ours = pos->bb[pos->color];
+	enemy = pos->bb[(pos->color == WHITE) ? BLACK : WHITE];
+	empty = ~(ours | enemy) & BOARD_FULL;
+	for (i = 0; i < LINES_MAX; i++) {
+		if (__builtin_popcountll(ours & line_masks[i]) >= BOARD_K - 1) {
+			points += __builtin_popcountll(empty & line_masks[i]);
+			points -= __builtin_popcountll(enemy & line_masks[i]);
+		}
+	}
+
+	return points;
+}
+
+/* Add a position to the end of a batch, which must not be full. */
+void batch_add(struct board_batch *batch, struct board_pos *pos)
+{
+	assert(batch->count < BATCH_MAX);
+	batch->ours[batch->count] = pos->bb[pos->color];
+	batch->theirs[batch->count] = pos->bb[(pos->color == WHITE) ? BLACK : WHITE];
+	batch->count++;
+}
+
+/*
+ * Set won[i] to what checkmate() returns for position i of the batch, with
+ * the same shifts as checkmate() but on BATCH_LANES boards at a time.
+ */
+void batch_checkmate(struct board_batch *batch, int *won)
+{
+	bitboard_vec player, run;
+	int i, j;
+
+	for (i = 0; i < batch->count; i += BATCH_LANES) {
+		player = *(bitboard_vec *)&batch->theirs[i];
+		run = vec_line_run(player, 1, STARTS_ROW)
+			| vec_line_run(player, BOARD_N, STARTS_COL)
+			| vec_line_run(player, BOARD_N + 1, STARTS_DIAG)
+			| vec_line_run(player, BOARD_N - 1, STARTS_ANTI);
+		for (j = 0; j < BATCH_LANES && i + j < batch->count; j++)
+			won[i + j] = run[j] != 0;
+	}
+}
+
+/*
+ * Set points[i] to what eval() returns for position i of the batch. eval()
+ * only scores the lines where we have all but one square: the line counts for
+ * us if its last square is empty, and against us if the enemy has it. So
+ * instead of counting the pieces of each line, we look for the lines where
+ * our pieces and the empty squares make a whole line with exactly one empty
+ * square, and the same with the enemy's pieces, in each direction at once
+ * like checkmate(). Then the score is the difference of the number of lines
+ * of each kind.
+ */
+void batch_eval(struct board_batch *batch, int *points)
+{
+	bitboard_vec ours, enemy, empty, open, blocked, plus, minus;
+	int i, j;
+
+	for (i = 0; i < batch->count; i += BATCH_LANES) {
+		ours = *(bitboard_vec *)&batch->ours[i];
+		enemy = *(bitboard_vec *)&batch->theirs[i];
+		empty = ~(ours | enemy) & BOARD_FULL;
+		open = ours | empty;
+		blocked = ours | enemy;
+		plus = vec_popcount(vec_line_run(open, 1, STARTS_ROW)
+				& vec_line_one(empty, 1, STARTS_ROW))
+			+ vec_popcount(vec_line_run(open, BOARD_N, STARTS_COL)
+				& vec_line_one(empty, BOARD_N, STARTS_COL))
+			+ vec_popcount(vec_line_run(open, BOARD_N + 1, STARTS_DIAG)
+				& vec_line_one(empty, BOARD_N + 1, STARTS_DIAG))
+			+ vec_popcount(vec_line_run(open, BOARD_N - 1, STARTS_ANTI)
+				& vec_line_one(empty, BOARD_N - 1, STARTS_ANTI));
+		minus = vec_popcount(vec_line_run(blocked, 1, STARTS_ROW)
+				& vec_line_one(enemy, 1, STARTS_ROW))
+			+ vec_popcount(vec_line_run(blocked, BOARD_N, STARTS_COL)
+				& vec_line_one(enemy, BOARD_N, STARTS_COL))
+			+ vec_popcount(vec_line_run(blocked, BOARD_N + 1, STARTS_DIAG)
+				& vec_line_one(enemy, BOARD_N + 1, STARTS_DIAG))
+			+ vec_popcount(vec_line_run(blocked, BOARD_N - 1, STARTS_ANTI)
+				& vec_line_one(enemy, BOARD_N - 1, STARTS_ANTI));
+		for (j = 0; j < BATCH_LANES && i + j < batch->count; j++)
+			points[i + j] = (int)plus[j] - (int)minus[j];
+	}
+}
+
+/* line_run() on every lane of a vector. */
+bitboard_vec vec_line_run(bitboard_vec pieces, int step, bitboard_t starts)
+{
+	bitboard_vec run;
+	int i;
+	run = pieces & starts;
+	for (i = 1; i < BOARD_K; i++)
+		run &= pieces >> (i * step);
+	return run;
+}
+
+/*
+ * Return the squares of starts that begin a line (as in line_run()) with
+ * exactly one square in pieces. The squares of the lines are added up one at
+ * a time, as two bits per square: one for at least one square in pieces so far,
+ * and two for at least two.
+ */
+bitboard_vec vec_line_one(bitboard_vec pieces, int step, bitboard_t starts)
+{
+	bitboard_vec one, two, next;
+	int i;
+	one = pieces;
+	two = pieces ^ pieces;
+	for (i = 1; i < BOARD_K; i++) {
+		next = pieces >> (i * step);
+		two |= one & next;
+		one |= next;
+	}
+	return one & ~two & starts;
+}
+
+/*
+ * Count the bits of each lane, by adding up neighbouring bits, then pairs of
+ * them, then nibbles, and the bytes of each lane with a multiplication, as
+ * there is no vector popcount instruction before AVX-512.
+ */
+bitboard_vec vec_popcount(bitboard_vec v)
+{
+	v = v - ((v >> 1) & (bitboard_t)0x5555555555555555ULL);
+	v = (v & (bitboard_t)0x3333333333333333ULL)
+		+ ((v >> 2) & (bitboard_t)0x3333333333333333ULL);
+	v = (v + (v >> 4)) & (bitboard_t)0x0f0f0f0f0f0f0f0fULL;
+	return (bitboard_vec)(v * (bitboard_t)0x0101010101010101ULL)
+		>> (8 * (sizeof(bitboard_t) - 1));
+}
+#else
+int eval(struct board_pos *pos)
+{
+	int i, enemy_color, ours, enemy, points;
+
+	points = 0;
+	enemy_color = (pos->color == WHITE) ? BLACK : WHITE;
+	/* Check each row, column, and diagonal for winning chances. */
+	for (i = 0; i < LINES_MAX; i++) {
+		ours = pos->lines[pos->color][i];
+		enemy = pos->lines[enemy_color][i];
+		/*
+		 * If we have all but one of our own lined up, check if there
+		 * is an un-occupied empty square that we can play to complete
+		 * the line in the next turn.
+		 */
+		if (ours >= BOARD_K - 1)
+			points += (BOARD_K - ours - enemy) - enemy;
+	}
+
+	return points;
+}
+#endif
+
+/*
+ * Return the score of a position where checkmate() says that the game is won,
+ * from White's point of view: the color that is not to move won it, with the
+ * pieces that are on the board.
+ */
+int score_won(struct board_pos *pos)
+{
+	int score;
+
+	score = SCORE_WIN(SQUARES_MAX - board_empty_count(pos));
+	return (pos->color == WHITE) ? -score : score;
+}
+
+/*
+ * minimax() is really an evaluation function; it merely looks at the root node
+ * (the given position), and evaluates it by looking at variations that result
+ * from playing different moves. The only real difference versus eval() and
+ * checkmate() is that minimax() calls itself recursively to find the
+ * evaluation. It is written as negamax: the score is from the point of view of
+ * the side to move, so that both colors maximize it, and the score of a move is
+ * minus the score of the position it leads to for the other side.
+ */
+int minimax(struct engine *e, struct board_pos *pos, int depth)
+{
+	struct move_list mlist;
+	int score, score_best, won, alpha, beta, move_best, i;
+	e->stats.nodes++;
+	if (e->budget_active)
+		budget_check(e);
+
+	/* Our score does not matter anymore (see move_search_smp()). */
+	if (atomic_load_explicit(e->stop, memory_order_relaxed))
+		return 0;
+
+	/* Check if position is already won */
+	STAT(e, checkmates);
+	won = checkmate(pos);
+	/*
+	 * If the game is WON, the other side made the last move, and thus won
+	 * the game, with as many pieces on the board as there are now.
+	 */
+	if (won) {
+		STAT(e, wins);
+		return -SCORE_WIN(SQUARES_MAX - board_empty_count(pos));
+	}
+
+	/* No one has won yet, but the board is full; this is a draw. */
+	if (!board_empty(pos)) {
+		STAT(e, draws);
+		return 0;
+	}
+
+	STAT(e, evals);
+	score = eval(pos);
+	/*
+	 * If we are at the end of our search "horizon," but no one won, just
+	 * return whatever eval() says it is, counted for the side that made
+	 * the last move (so against us).
+	 */
+	if (depth == 0) {
+		STAT(e, leaves);
+		return -score;
+	}
+
+	/* We may have already searched this position. */
+	alpha = -INF;
+	beta = INF;
+	if (tt_probe(e, pos, depth, &alpha, &beta, &score, &move_best))
+		return score;
+
+	/*
+	 * If we are here, it means that the game has not ended yet, so we do
+	 * our usual evaluation of it. First, we generate all possible moves.
+	 * Then, we try out each move on the board, and then call our evaluation
+	 * function. If the level of difficulty is high, we search all possible
+	 * variations (as deep as there are squares). On medium, we only search
+	 * down to depth 3. On easy, we only search down to depth 1. Without
+	 * pruning, the order of the moves makes no difference.
+	 */
+	STAT(e, interior);
+	STAT(e, generates);
+	move_generate(pos, &mlist);
+	if (e->order_shift)
+		move_rotate(&mlist, e->order_shift);
+
+	/* Start out with -INF, and try to maximize it. */
+	score = -INF;
+	move_best = mlist.move[0];
+	for (i = 0; i < mlist.moves; i++) {
+		move_do(pos, mlist.move[i]);
+		score_best = -minimax(e, pos, depth - 1);
+		move_undo(pos, mlist.move[i]);
+		/* Don't store the score of a search that was cut short. */
+		if (atomic_load_explicit(e->stop, memory_order_relaxed))
+			return 0;
+		if (score_best > score) {
+			score = score_best;
+			move_best = mlist.move[i];
+		}
+	}
+
+	tt_store(e, pos, depth, score, BOUND_EXACT, move_best);
+	return score;
+}
+
+/*
+ * alphabeta() returns the same score as minimax() whenever that score lies
+ * between alpha and beta, from the point of view of the side to move. We are
+ * guaranteed at least alpha elsewhere in the tree, and the other side would
+ * never let us get beta or more, so as soon as a move proves that the position
+ * is outside of that window, the rest of the moves are not searched: the score
+ * returned is then only a bound (at most alpha, or at least beta).
+ *
+ * Once a move has raised alpha, the rest are searched with principal variation
+ * search: we expect that move (the best one, if move_order() got it right) to
+ * stay the best, so at first we only try to prove that the others are no
+ * better than alpha, with the null window (alpha, alpha + 1), which prunes far
+ * more. Only a move that turns out better than alpha is searched again with
+ * the whole window, to get its score.
+ */
+int alphabeta(struct engine *e, struct board_pos *pos, int depth, int alpha, int beta)
+{
+	struct move_list mlist;
+	int score, score_best, won, alpha_orig, beta_orig, move_best, hash_move, ply, i;
+	e->stats.nodes++;
+	if (e->budget_active)
+		budget_check(e);
+
+	if (atomic_load_explicit(e->stop, memory_order_relaxed))
+		return 0;
+
+	/* Terminal and horizon nodes are scored just like in minimax(). */
+	STAT(e, checkmates);
+	won = checkmate(pos);
+	ply = SQUARES_MAX - board_empty_count(pos);
+	if (won) {
+		STAT(e, wins);
+		return -SCORE_WIN(ply);
+	}
+
+	if (!board_empty(pos)) {
+		STAT(e, draws);
+		return 0;
+	}
+
+	if (depth == 0) {
+		STAT(e, leaves);
+		STAT(e, evals);
+		return -eval(pos);
+	}
+
+	/*
+	 * At best we win with our next move, and at worst we lose to the move
+	 * after it. If that is all outside of the window, we need not search:
+	 * the window only gets narrower below us, so once a win is found, no
+	 * longer one is searched.
+	 */
+	if (SCORE_WIN(ply + 1) <= alpha)
+		return SCORE_WIN(ply + 1);
+	if (-SCORE_WIN(ply + 2) >= beta)
+		return -SCORE_WIN(ply + 2);
+	alpha = MAX(alpha, -SCORE_WIN(ply + 2));
+	beta = MIN(beta, SCORE_WIN(ply + 1));
+
+	if (tt_probe(e, pos, depth, &alpha, &beta, &score, &hash_move))
+		return score;
+	/* Remember the window, to know what kind of score we end up with. */
+	alpha_orig = alpha;
+	beta_orig = beta;
+
+	STAT(e, interior);
+	STAT(e, generates);
+	move_generate(pos, &mlist);
+	move_order(e, pos, &mlist, hash_move);
+	if (e->order_shift)
+		move_rotate(&mlist, e->order_shift);
+
+	score = -INF;
+	move_best = mlist.move[0];
+	for (i = 0; i < mlist.moves; i++) {
+		move_do(pos, mlist.move[i]);
+		if (alpha == alpha_orig) {
+			score_best = -alphabeta(e, pos, depth - 1, -beta, -alpha);
+		} else {
+			score_best = -alphabeta(e, pos, depth - 1, -alpha - 1, -alpha);
+			if (score_best > alpha && score_best < beta)
+				score_best = -alphabeta(e, pos, depth - 1, -beta,
+					-alpha);
+		}
+		move_undo(pos, mlist.move[i]);
+		if (atomic_load_explicit(e->stop, memory_order_relaxed))
+			return 0;
+		if (score_best > score) {
+			score = score_best;
+			move_best = mlist.move[i];
+		}
+		alpha = MAX(alpha, score);
+		/*
+		 * The opponent will never allow this position; stop here, and
+		 * remember the move that showed it, to search it first in
+		 * other positions.
+		 */
+		if (alpha >= beta) {
+			e->stats.cutoffs++;
+			if (i == 0)
+				e->stats.cutoffs_first++;
+			if (e->killers[ply][0] != move_best) {
+				e->killers[ply][1] = e->killers[ply][0];
+				e->killers[ply][0] = move_best;
+			}
+			e->history[pos->color][move_best] += depth * depth;
+			break;
+		}
+	}
+
+	if (score <= alpha_orig)
+		tt_store(e, pos, depth, score, BOUND_UPPER, move_best);
+	else if (score >= beta_orig)
+		tt_store(e, pos, depth, score, BOUND_LOWER, move_best);
+	else
+		tt_store(e, pos, depth, score, BOUND_EXACT, move_best);
+	return score;
+}
+
+/*
+ * Look up the position in the transposition table. An entry is only used if it
+ * was searched to the same depth, so that the transposition table never changes
+ * the result of a search. Depths beyond the number of empty squares all give
+ * the same (exact) result, so they count as the same depth. A bound narrows the
+ * (alpha, beta) window; return true, with the score in *score, if the entry
+ * settles the score of the position so that it need not be searched. Either
+ * way, *move is the best move of the entry (to search first), even if it was
+ * searched to a different depth; or MOVE_NONE if the position has no entry.
+ */
+bool tt_probe(struct engine *e, struct board_pos *pos, int depth, int *alpha,
+	int *beta, int *score, int *move)
+{
+	struct tt_entry entry;
+
+	*move = MOVE_NONE;
+	if (!tt_enabled)
+		return false;
+	STAT(e, tt_probes);
+	if (!tt_lookup(e, pos, &entry)) {
+		e->stats.tt_misses++;
+		return false;
+	}
+	*move = entry.move;
+	if (entry.depth != MIN(depth, board_empty_count(pos))) {
+		e->stats.tt_misses++;
+		return false;
+	}
+
+	switch (entry.bound) {
+	case BOUND_EXACT:
+		*alpha = entry.score;
+		*beta = entry.score;
+		break;
+	case BOUND_LOWER: *alpha = MAX(*alpha, entry.score); break;
+	case BOUND_UPPER: *beta = MIN(*beta, entry.score); break;
+	default: assert(0);
+	}
+
+	if (*alpha >= *beta) {
+		e->stats.tt_hits++;
+		*score = entry.score;
+		return true;
+	}
+	e->stats.tt_misses++;
+	return false;
+}
+
+/*
+ * Return the best move stored for the position in the transposition table, or
+ * MOVE_NONE.
  */
-int checkmate(struct board_pos *pos)
+int tt_move(struct engine *e, struct board_pos *pos)
 {
-	int i, j, player_color, ours;
-	/*
-	 * Get the color that just played the last move (the opposite of the
-	 * current color).
-	 */
-	player_color = (pos->color == WHITE) ? BLACK : WHITE;
-	/* Check each won condition. */
-	for (i = 0; i < 8; i++) {
-		ours = 0;
-		for (j = 0; j < 3; j++) {
-			if (pos->sq[winning_squares[i][j]] == player_color)
-				ours++;
-			else
-				break;
+	struct tt_entry entry;
+
+	if (!tt_lookup(e, pos, &entry))
+		return MOVE_NONE;
+	return entry.move;
+}
+
+/*
+ * Read the entry of the position into *entry, with its move turned back onto
+ * the board of the position. Return false if the position has no entry.
+ */
+bool tt_lookup(struct engine *e, struct board_pos *pos, struct tt_entry *entry)
+{
+	tt_word word;
+	uint64_t key;
+	int sym;
+
+	if (!tt_enabled)
+		return false;
+
+	key = tt_key(pos, &sym);
+	word = atomic_load_explicit(&e->tt[TT_SLOT(key)], memory_order_relaxed);
+	TT_UNPACK(*entry, word);
+	if (entry->bound == BOUND_NONE || (word ^ TT_CHECK(key)) >> TT_DATA_BITS)
+		return false;
+	if (entry->move != MOVE_NONE)
+		entry->move = symmetry[symmetry_inverse[sym]][entry->move];
+	return true;
+}
+
+/*
+ * Store the score of a searched position in the transposition table, with its
+ * best move (or MOVE_NONE if we don't know it).
+ */
+void tt_store(struct engine *e, struct board_pos *pos, int depth, int score,
+	int bound, int move)
+{
+	struct tt_entry entry;
+	uint64_t key;
+	int sym;
+
+	if (!tt_enabled)
+		return;
+
+	key = tt_key(pos, &sym);
+	entry.score = score;
+	entry.depth = MIN(depth, board_empty_count(pos));
+	entry.bound = bound;
+	entry.move = (move == MOVE_NONE) ? MOVE_NONE : symmetry[sym][move];
+	atomic_store_explicit(&e->tt[TT_SLOT(key)], TT_CHECK(key) | TT_PACK(entry),
+		memory_order_relaxed);
+}
+
+/*
+ * Return the number that the position goes by in the transposition table (see
+ * TT_SLOT()), and in *sym the symmetry that turns the board into the one that
+ * is stored: with sym_enabled, that of the lowest index of all symmetric
+ * positions.
+ */
+uint64_t tt_key(struct board_pos *pos, int *sym)
+{
+	if (sym_enabled)
+		return (uint64_t)board_canonical(pos, sym) * 2 + pos->color;
+	*sym = 0;
+	return (uint64_t)pos->index[0] * 2 + pos->color;
+}
+
+/* Forget all searched positions. */
+void tt_clear(struct engine *e)
+{
+	int i;
+	for (i = 0; i < TT_SIZE; i++)
+		atomic_store_explicit(&e->tt[i], 0, memory_order_relaxed);
+}
+
+/*
+ * Return the index shared by the position and all of its symmetric positions:
+ * the lowest of them. *sym is the symmetry that gives it (the lowest one, if
+ * several do).
+ */
+index_t board_canonical(struct board_pos *pos, int *sym)
+{
+	index_t index;
+	int s;
+	index = pos->index[0];
+	*sym = 0;
+	for (s = 1; s < SYMMETRIES; s++) {
+		if (pos->index[s] < index) {
+			index = pos->index[s];
+			*sym = s;
 		}
-		/* If we have a 3 in a row, then yes, somebody won the game! */
-		if (ours == 3)
-			return 1;
 	}
+	return index;
+}
 
-	/* Nobody won the game so far. */
-	return 0;
+/* Add digit to square sq in every board_pos.index. */
+void board_index_add(struct board_pos *pos, int sq, int digit)
+{
+	int s;
+	for (s = 0; s < SYMMETRIES; s++)
+		pos->index[s] += digit * pow3[symmetry[s][sq]];
 }
 
 /*
- * Examine the position, and return a score based on how many possible
- * three-in-a-row opportunities there are. The higher the score, the more
- * opportunities. This function is very similar to checkmate(), because of the
- * simplicity of the game.
+ * Set up the tables of the board that are not written out in full or compiled
+ * in: see board_tables(), symmetry_inverse[], square_weight[] and line_masks[].
  */
-int eval(struct board_pos *pos)
+void board_init()
 {
-	int i, j, enemy_color, ours, points;
-	points = 0;
-	enemy_color = (pos->color == WHITE) ? BLACK : WHITE;
-	/* Check each row, column, and diagonal for winning chances. */
-	for (i = 0; i < 8; i++) {
-		ours = 0;
-		for (j = 0; j < 3; j++) {
-			if (pos->sq[winning_squares[i][j]] == pos->color)
-				ours++;
+	const int *line_of;
+	int sq, s, t;
+#ifdef BITBOARD
+	int line, i;
+#endif
+
+#if !BOARD_3X3
+	board_tables();
+#endif
+	for (s = 0; s < SYMMETRIES; s++) {
+		for (t = 0; t < SYMMETRIES; t++) {
+			for (sq = 0; sq < SQUARES_MAX; sq++) {
+				if (symmetry[t][symmetry[s][sq]] != sq)
+					break;
+			}
+			if (sq == SQUARES_MAX)
+				symmetry_inverse[s] = t;
 		}
-		/*
-		 * If we have 2 of our own lined up, check if there is an
-		 * un-occupied empty square that we can play to make a
-		 * three-in-a-row in the next turn.
-		 */
-		if (ours > 1) {
-			for (j = 0; j < 3; j++) {
-				if (pos->sq[winning_squares[i][j]] == EMPTY)
-					points++;
-				if (pos->sq[winning_squares[i][j]] == enemy_color)
-					points--;
+	}
+	for (sq = 0; sq < SQUARES_MAX; sq++) {
+		square_weight[sq] = 0;
+		for (line_of = square_lines[sq]; *line_of != -1; line_of++)
+			square_weight[sq]++;
+	}
+#ifdef BITBOARD
+	for (line = 0; line < LINES_MAX; line++) {
+		line_masks[line] = 0;
+		for (i = 0; i < BOARD_K; i++)
+			line_masks[line] |= (bitboard_t)1 << winning_squares[line][i];
+		assert(line_masks[line] == winning_masks[line]);
+	}
+#endif
+}
+
+#if !BOARD_3X3
+/*
+ * Fill in the line, power and symmetry tables of the board, which tic-tac-toe
+ * has written out by hand. The lines come in the same order: rows, columns,
+ * and then diagonals.
+ */
+void board_tables()
+{
+	/* Row and column steps from one square of a line to the next. */
+	static const int step[4][2] = {{0, 1}, {1, 0}, {1, 1}, {1, -1}};
+	int count[SQUARES_MAX];
+	int d, r, c, i, line, sq, s;
+
+	line = 0;
+	for (d = 0; d < 4; d++) {
+		for (r = 0; r < BOARD_M; r++) {
+			for (c = 0; c < BOARD_N; c++) {
+				/* The line has to end on the board. */
+				if (r + (BOARD_K - 1) * step[d][0] >= BOARD_M
+					|| c + (BOARD_K - 1) * step[d][1] >= BOARD_N
+					|| c + (BOARD_K - 1) * step[d][1] < 0)
+					continue;
+				for (i = 0; i < BOARD_K; i++) {
+					winning_squares[line][i] = (r + i * step[d][0]) * BOARD_N
+						+ c + i * step[d][1];
+				}
+				line++;
 			}
 		}
 	}
+	assert(line == LINES_MAX);
 
-	return points;
+	for (sq = 0; sq < SQUARES_MAX; sq++)
+		count[sq] = 0;
+	for (line = 0; line < LINES_MAX; line++) {
+		for (i = 0; i < BOARD_K; i++) {
+			sq = winning_squares[line][i];
+			square_lines[sq][count[sq]++] = line;
+		}
+	}
+	for (sq = 0; sq < SQUARES_MAX; sq++) {
+		assert(count[sq] < SQUARE_LINES_MAX);
+		square_lines[sq][count[sq]] = -1;
+	}
+
+	pow3[0] = 1;
+	for (sq = 1; sq < SQUARES_MAX; sq++)
+		pow3[sq] = pow3[sq - 1] * 3;
+
+	for (sq = 0; sq < SQUARES_MAX; sq++) {
+		r = sq / BOARD_N;
+		c = sq % BOARD_N;
+		s = 0;
+		symmetry[s++][sq] = sq; /* identity */
+		/* rotate 180 degrees */
+		symmetry[s++][sq] = (BOARD_M - 1 - r) * BOARD_N + (BOARD_N - 1 - c);
+		/* mirror left-right */
+		symmetry[s++][sq] = r * BOARD_N + (BOARD_N - 1 - c);
+		/* mirror top-bottom */
+		symmetry[s++][sq] = (BOARD_M - 1 - r) * BOARD_N + c;
+#if SYMMETRIES == 8
+		/* rotate 90 degrees clockwise */
+		symmetry[s++][sq] = c * BOARD_N + (BOARD_N - 1 - r);
+		/* rotate 270 degrees clockwise */
+		symmetry[s++][sq] = (BOARD_N - 1 - c) * BOARD_N + r;
+		/* mirror along the diagonal from square 0 */
+		symmetry[s++][sq] = c * BOARD_N + r;
+		/* mirror along the other diagonal */
+		symmetry[s++][sq] = (BOARD_N - 1 - c) * BOARD_N + (BOARD_N - 1 - r);
+#endif
+		assert(s == SYMMETRIES);
+	}
 }
+#endif
 
 /*
- * minimax() is really an evaluation function; it merely looks at the root node
- * (the given position), and evaluates it by looking at variations that result
- * from playing different moves. The only real difference versus eval() and
- * checkmate() is that minimax() calls itself recursively to find the
- * evaluation.
+ * Generate the moves to search in the given position: the same moves as
+ * move_generate_all(), except that if some symmetry of the board leaves the
+ * position unchanged, moves that it maps onto each other lead to symmetric
+ * positions with the same score. Of these, we only keep the lowest square.
  */
-int minimax(struct board_pos *pos, int depth)
+void move_generate(struct board_pos *pos, struct move_list *mp)
 {
-	struct move_list mlist;
-	int score, score_best, won, i;
-	nodecount++;
+	int symmetric[SYMMETRIES];
+	int i, j, s, syms;
 
-	/* Check if position is already won */
-	won = checkmate(pos);
-	/*
-	 * If the game is WON and it is WHITE to move, that means BLACK made the
-	 * last move, and thus, BLACK won the game (-INF achieved!)
-	 */
-	if (won)
-		return ((pos->color == WHITE) ? -INF : INF);
+	move_generate_all(pos, mp);
+	if (!sym_enabled)
+		return;
 
-	/* No one has won yet, but the board is full; this is a draw. */
-	if (!board_empty(pos))
-		return 0;
+	/* Find the symmetries (other than identity) that fix the position. */
+	syms = 0;
+	for (s = 1; s < SYMMETRIES; s++) {
+		if (pos->index[s] == pos->index[0])
+			symmetric[syms++] = s;
+	}
+	if (!syms)
+		return;
 
-	score = eval(pos);
-	/*
-	 * If we are at the end of our search "horizon," but no one won, just
-	 * return whatever eval() says it is.
-	 */
-	if (depth == 0) {
-		/* if it is WHITE to move, that means BLACK made the last move,
-		 * so we have to return a negative value in that case (remember,
-		 * BLACK is trying to find the most negative value)
-		 */
-		return ((pos->color == WHITE) ? -score : score);
+	/* Drop every move that a symmetry maps onto a lower square. */
+	for (i = 0, j = 0; i < mp->moves; i++) {
+		for (s = 0; s < syms; s++) {
+			if (symmetry[symmetric[s]][mp->move[i]] < mp->move[i])
+				break;
+		}
+		if (s == syms)
+			mp->move[j++] = mp->move[i];
 	}
+	mp->moves = j;
+}
 
-	/*
-	 * If we are here, it means that the game has not ended yet, so we do
-	 * our usual evaluation of it. First, we generate all possible moves.
-	 * Then, we try out each move on the board, and then call our evaluation
-	 * function. If the level of difficulty is high, we search all possible
-	 * variations (depth 9). On medium, we only search down to depth 3. On
-	 * easy, we only search down to depth 1.
-	 */
-	move_generate(pos, &mlist);
+/* Move the first shift moves (modulo the number of moves) to the end. */
+void move_rotate(struct move_list *mp, int shift)
+{
+	int8_t move[MOVES_MAX];
+	int i;
 
-	/*
-	 * White starts out with -INF and tries to maximize it; Black starts
-	 * with INF and tries to minimize it.
-	 */
-	score = (pos->color == WHITE) ? -INF : INF;
-	for (i = 0; i < mlist.moves; i++) {
-		move_do(pos, mlist.move[i]);
-		score_best = minimax(pos, depth - 1);
-		move_undo(pos, mlist.move[i]);
-		if (pos->color == WHITE)
-			score = MAX(score, score_best);
+	if (!mp->moves)
+		return;
+	for (i = 0; i < mp->moves; i++)
+		move[i] = mp->move[(i + shift) % mp->moves];
+	for (i = 0; i < mp->moves; i++)
+		mp->move[i] = move[i];
+}
+
+/*
+ * Sort the moves so that those most likely to be best come first, as alpha-beta
+ * prunes the most when it searches the best move first: hash_move (the best
+ * move found when the position was searched before) first, then the killer
+ * moves of the ply, then the moves with the highest history score, and then the
+ * squares on the most lines. Moves that tie on all of these stay lowest square
+ * first.
+ */
+void move_order(struct engine *e, struct board_pos *pos, struct move_list *mp,
+	int hash_move)
+{
+	uint64_t key[MOVES_MAX], k;
+	int ply, move, i, j;
+
+	ply = SQUARES_MAX - board_empty_count(pos);
+	for (i = 0; i < mp->moves; i++) {
+		move = mp->move[i];
+		if (move == hash_move)
+			k = 3;
+		else if (move == e->killers[ply][0])
+			k = 2;
+		else if (move == e->killers[ply][1])
+			k = 1;
 		else
-			score = MIN(score, score_best);
+			k = 0;
+		k = k << 56 | (uint64_t)e->history[pos->color][move] << 16
+			| square_weight[move] << 8 | (SQUARES_MAX - move);
+
+		/* Insert the move among the ones sorted so far. */
+		for (j = i; j > 0 && key[j - 1] < k; j--) {
+			key[j] = key[j - 1];
+			mp->move[j] = mp->move[j - 1];
+		}
+		key[j] = k;
+		mp->move[j] = move;
 	}
+}
 
-	return score;
+/* Forget the move ordering of the last search of this thread. */
+void order_reset(struct engine *e)
+{
+	int i;
+
+	for (i = 0; i < SQUARES_MAX; i++) {
+		e->killers[i][0] = MOVE_NONE;
+		e->killers[i][1] = MOVE_NONE;
+		e->history[WHITE][i] = 0;
+		e->history[BLACK][i] = 0;
+	}
 }
 
 /*
@@ -462,13 +4209,77 @@ int minimax(struct board_pos *pos, int depth)
  * number of possible moves in this position (the total number of empty
  * squares).
  */
-void move_generate(struct board_pos *pos, struct move_list *mp)
+#ifdef BITBOARD
+void move_generate_all(struct board_pos *pos, struct move_list *mp)
 {
-	int i;
-	/* Reset the move list. */
-	for (i = 0; i < MOVES_MAX; i++) {
-		mp->move[i] = MOVE_NONE;
+	bitboard_t empty;
+
+	mp->moves = 0;
+
+	/*
+	 * Find all empty squares, lowest square first, and place the moves into
+	 * mp.
+	 */
+	empty = ~(pos->bb[WHITE] | pos->bb[BLACK]) & BOARD_FULL;
+	while (empty) {
+		mp->move[mp->moves] = __builtin_ctzll(empty);
+		mp->moves++;
+		empty &= empty - 1;
 	}
+}
+
+/* Execute the move on the board. */
+void move_do(struct board_pos *pos, int move)
+{
+	pos->bb[pos->color] |= (bitboard_t)1 << move;
+	board_index_add(pos, move, pos->color + 1);
+	pos->color = (pos->color == WHITE) ? BLACK : WHITE;
+}
+
+/* Undo a move on the board. */
+void move_undo(struct board_pos *pos, int move)
+{
+	pos->color = (pos->color == WHITE) ? BLACK : WHITE;
+	pos->bb[pos->color] &= ~((bitboard_t)1 << move);
+	board_index_add(pos, move, -(pos->color + 1));
+}
+
+bool board_empty(struct board_pos *pos)
+{
+	return (pos->bb[WHITE] | pos->bb[BLACK]) != BOARD_FULL;
+}
+
+/* Return the number of empty squares. */
+int board_empty_count(struct board_pos *pos)
+{
+	return SQUARES_MAX - __builtin_popcountll(pos->bb[WHITE] | pos->bb[BLACK]);
+}
+
+/* Clear all squares, with WHITE to move. */
+void board_reset(struct board_pos *pos)
+{
+	int i;
+	pos->bb[WHITE] = 0;
+	pos->bb[BLACK] = 0;
+	pos->color = WHITE;
+	for (i = 0; i < SYMMETRIES; i++)
+		pos->index[i] = 0;
+}
+
+/* Return the piece on the given square: WHITE, BLACK, or EMPTY. */
+int board_square(struct board_pos *pos, int sq)
+{
+	if (pos->bb[WHITE] & ((bitboard_t)1 << sq))
+		return WHITE;
+	if (pos->bb[BLACK] & ((bitboard_t)1 << sq))
+		return BLACK;
+	return EMPTY;
+}
+#else
+void move_generate_all(struct board_pos *pos, struct move_list *mp)
+{
+	int i;
+
 	mp->moves = 0;
 
 	/* Find all empty squares, and place the moves into mp. */
@@ -483,25 +4294,216 @@ void move_generate(struct board_pos *pos, struct move_list *mp)
 /* Execute the move on the board. */
 void move_do(struct board_pos *pos, int move)
 {
+	const int *line;
+
 	pos->sq[move] = pos->color;
+	for (line = square_lines[move]; *line != -1; line++)
+		pos->lines[pos->color][*line]++;
+	pos->empties--;
+	board_index_add(pos, move, pos->color + 1);
 	pos->color = (pos->color == WHITE) ? BLACK : WHITE;
+	pos->last = move;
 }
 
 /* Undo a move on the board. */
 void move_undo(struct board_pos *pos, int move)
 {
+	const int *line;
+
 	pos->sq[move] = EMPTY;
 	pos->color = (pos->color == WHITE) ? BLACK : WHITE;
+	for (line = square_lines[move]; *line != -1; line++)
+		pos->lines[pos->color][*line]--;
+	pos->empties++;
+	board_index_add(pos, move, -(pos->color + 1));
+	pos->last = MOVE_NONE;
 }
 
 bool board_empty(struct board_pos *pos)
+{
+	return pos->empties != 0;
+}
+
+/* Return the number of empty squares. */
+int board_empty_count(struct board_pos *pos)
+{
+	return pos->empties;
+}
+
+/* Clear all squares, with WHITE to move. */
+void board_reset(struct board_pos *pos)
 {
 	int i;
+	for (i = 0; i < SQUARES_MAX; i++)
+		pos->sq[i] = EMPTY;
+	for (i = 0; i < LINES_MAX; i++) {
+		pos->lines[WHITE][i] = 0;
+		pos->lines[BLACK][i] = 0;
+	}
+	pos->empties = SQUARES_MAX;
+	pos->color = WHITE;
+	pos->last = MOVE_NONE;
+	for (i = 0; i < SYMMETRIES; i++)
+		pos->index[i] = 0;
+}
+
+/* Return the piece on the given square: WHITE, BLACK, or EMPTY. */
+int board_square(struct board_pos *pos, int sq)
+{
+	return pos->sq[sq];
+}
+#endif
+
+/*
+ * Set up the board written in str, which holds nothing else (see board_read()).
+ * Return false if str is not such a board, or if the board cannot come up in a
+ * game.
+ */
+bool board_parse(struct board_pos *pos, const char *str)
+{
+	const char *end = board_read(pos, str);
+
+	return end && *end == '\0';
+}
+
+/*
+ * Set up the board that str starts with: one character per square, in order
+ * from square 0 to SQUARES_MAX - 1, that is 'X' for White, 'O' for Black, or
+ * '.' if the square is empty, and then 'x' or 'o' for the color to move, as
+ * board_write() writes it, for example "XO.X.....o". Without the color, it
+ * follows from the number of pieces, as White moves first. Return where the
+ * board ends in str, which is neither copied nor measured, or NULL if str does
+ * not start with a board that can come up in a game.
+ */
+const char *board_read(struct board_pos *pos, const char *str)
+{
+	int i, pieces[2];
+
+	board_reset(pos);
+	pieces[WHITE] = 0;
+	pieces[BLACK] = 0;
 	for (i = 0; i < SQUARES_MAX; i++) {
-		if (pos->sq[i] == EMPTY)
-			return true;
+		switch (str[i]) {
+		case 'X': pos->color = WHITE; break;
+		case 'O': pos->color = BLACK; break;
+		case '.': continue;
+		default: return NULL;
+		}
+		pieces[pos->color]++;
+		move_do(pos, i);
 	}
-	return false;
+	if (!board_settle(pos, pieces[WHITE], pieces[BLACK]))
+		return NULL;
+
+	switch (str[i]) {
+	case 'x': return (pos->color == WHITE) ? str + i + 1 : NULL;
+	case 'o': return (pos->color == BLACK) ? str + i + 1 : NULL;
+	default: return str + i;
+	}
+}
+
+/*
+ * Write the board into buf as board_read() reads it, with the color to move,
+ * and return its length (BOARD_TEXT); buf is not terminated.
+ */
+int board_write(struct board_pos *pos, char *buf)
+{
+	int i;
+
+	for (i = 0; i < SQUARES_MAX; i++) {
+		switch (board_square(pos, i)) {
+		case WHITE: buf[i] = 'X'; break;
+		case BLACK: buf[i] = 'O'; break;
+		default: buf[i] = '.'; break;
+		}
+	}
+	buf[i++] = (pos->color == WHITE) ? 'x' : 'o';
+	return i;
+}
+
+/*
+ * Return the code of the board: its index (see board_pos.index) times 2, plus
+ * the color to move, as in tt_key(). For tic-tac-toe it fits in 2 bytes.
+ */
+code_t board_pack(struct board_pos *pos)
+{
+	return (code_t)pos->index[0] * 2 + pos->color;
+}
+
+/*
+ * Set up the board of a code from board_pack(). Return false if it is not the
+ * code of a board that can come up in a game.
+ */
+bool board_unpack(struct board_pos *pos, code_t code)
+{
+	index_t index;
+	int sq, digit, pieces[2];
+
+	if (code / 2 / 3 >= pow3[SQUARES_MAX - 1])
+		return false;
+	index = code / 2;
+	board_reset(pos);
+	pieces[WHITE] = 0;
+	pieces[BLACK] = 0;
+	for (sq = 0; index; sq++, index /= 3) {
+		digit = index % 3;
+		if (!digit)
+			continue;
+		pos->color = digit - 1;
+		pieces[pos->color]++;
+		move_do(pos, sq);
+	}
+	return board_settle(pos, pieces[WHITE], pieces[BLACK])
+		&& pos->color == (int)(code % 2);
+}
+
+/*
+ * Finish setting up a board from board_read() or board_unpack(), with the given
+ * number of pieces of each color on it: set the color to move from them, as
+ * White moves first. Return false if the board cannot come up in a game.
+ */
+bool board_settle(struct board_pos *pos, int white, int black)
+{
+#ifndef BITBOARD
+	/* The squares were set directly, so there is no last move to go by. */
+	pos->last = MOVE_NONE;
+#endif
+	/*
+	 * The color to move cannot have a full line, because the game would
+	 * have ended before the other color moved.
+	 */
+	if (white == black)
+		pos->color = BLACK;
+	else if (white == black + 1)
+		pos->color = WHITE;
+	else
+		return false;
+	if (checkmate(pos))
+		return false;
+	pos->color = (pos->color == WHITE) ? BLACK : WHITE;
+	return true;
+}
+
+/* printf(), if verbosity is at least level. */
+void report(int level, const char *format, ...)
+{
+	va_list ap;
+
+	if (verbosity < level)
+		return;
+	va_start(ap, format);
+	vprintf(format, ap);
+	va_end(ap);
+}
+
+/*
+ * Read a key press, after showing the user everything printed so far; stdout
+ * is buffered, so that a board is written in one go.
+ */
+int read_key()
+{
+	fflush(stdout);
+	return getchar();
 }
 
 /* Print a list of available moves that can be played. */
@@ -509,40 +4511,114 @@ void display_moves(struct move_list *mp)
 {
 	int i;
 	for (i = 0; i < mp->moves; i++) {
-		switch (mp->move[i]) {
-		case 0: printf("0"); break;
-		case 1: printf("1"); break;
-		case 2: printf("2"); break;
-		case 3: printf("3"); break;
-		case 4: printf("4"); break;
-		case 5: printf("5"); break;
-		case 6: printf("6"); break;
-		case 7: printf("7"); break;
-		case 8: printf("8"); break;
-		default: assert(0);
-		}
-		printf(" ");
+		assert(mp->move[i] >= 0 && mp->move[i] < SQUARES_MAX);
+		printf("%c ", square_names[mp->move[i]]);
 	}
 	printf("\n");
 }
 
+/*
+ * Report what move_pick() found, and how long it took, unless verbosity is below
+ * VERBOSITY_SEARCH; depth is the depth move_pick() was asked to search to.
+ */
+void display_result(struct search_result *result, int depth)
+{
+	if (verbosity < VERBOSITY_SEARCH)
+		return;
+	if (result->lookup) {
+		printf("Looked up perfect play, best move is: %d (the game ends in %d moves)\n",
+			result->move + 1, result->distance);
+		return;
+	}
+	if (search_compare)
+		printf("minimax: %u nodes, best move %d; alpha-beta: %u nodes, best move %d\n",
+			result->nodes_minimax, result->move_minimax + 1, result->stats.nodes,
+			result->move + 1);
+	else if (result->budget)
+		printf("Searched to depth %d of %d within budget\n", result->depth, depth);
+	printf("After examining %u nodes in %.3f ms", result->stats.nodes,
+		result->seconds * 1e3);
+	if (tt_enabled)
+		printf(" (transposition table: %u hits, %u misses)", result->stats.tt_hits,
+			result->stats.tt_misses);
+	if (result->stats.cutoffs)
+		printf(" (%u cutoffs, %.1f%% on the first move)", result->stats.cutoffs,
+			100.0 * result->stats.cutoffs_first / result->stats.cutoffs);
+	printf(", best move is: %d\n", result->move + 1);
+}
+
+/*
+ * Write what move_pick() found for pos to search_log, on one line of key=value
+ * pairs, so that other programs can follow how long each search takes and how
+ * big it is. depth is the depth move_pick() was asked to search to; ply is the
+ * number of pieces on the board. Times are in microseconds. The counters of
+ * struct search_stats are only there in a build with -DSTATS.
+ */
+void log_result(struct board_pos *pos, struct search_result *result, int depth)
+{
+	fprintf(search_log, "search ply=%d move=%d score=%d depth=%d depth_max=%d"
+		" lookup=%d distance=%d time_us=%.1f nodes=%u tt_hits=%u tt_misses=%u"
+		" cutoffs=%u cutoffs_first=%u",
+		SQUARES_MAX - board_empty_count(pos), result->move, result->score,
+		result->depth, depth, result->lookup, result->distance, result->seconds * 1e6,
+		result->stats.nodes, result->stats.tt_hits, result->stats.tt_misses,
+		result->stats.cutoffs, result->stats.cutoffs_first);
+#ifdef STATS
+	fprintf(search_log, " checkmates=%lu evals=%lu generates=%lu leaves=%lu"
+		" interior=%lu wins=%lu draws=%lu tt_probes=%lu",
+		result->stats.checkmates, result->stats.evals, result->stats.generates,
+		result->stats.leaves, result->stats.interior, result->stats.wins,
+		result->stats.draws, result->stats.tt_probes);
+#endif
+	fprintf(search_log, "\n");
+}
+
+/* Print the board with one write, so that it shows up all at once. */
 void display_board(struct board_pos *pos)
 {
+	char frame[FRAME_MAX];
+
+	fwrite(frame, 1, board_frame(pos, frame), stdout);
+}
+
+/* Write the board as display_board() prints it into buf, and return its length. */
+int board_frame(struct board_pos *pos, char *buf)
+{
+	char *p = buf;
 	int i;
-	printf("\n+---+---+---+\n");
+
+	*p++ = '\n';
+	p = frame_rule(p);
 	for (i = 0; i < SQUARES_MAX; i++) {
-		printf("| ");
-		switch (pos->sq[i]) {
-		case WHITE: printf("X"); break;
-		case BLACK: printf("O"); break;
-		case EMPTY: printf(" "); break;
-		default: break;
+		*p++ = '|';
+		*p++ = ' ';
+		switch (board_square(pos, i)) {
+		case WHITE: *p++ = 'X'; break;
+		case BLACK: *p++ = 'O'; break;
+		default: *p++ = ' '; break;
 		}
-		printf(" ");
-		if (i == 2 || i == 5 || i == 8) {
-			printf("|\n");
-			printf("+---+---+---+\n");
+		*p++ = ' ';
+		if (i % BOARD_N == BOARD_N - 1) {
+			*p++ = '|';
+			*p++ = '\n';
+			p = frame_rule(p);
 		}
 	}
-	printf("\n");
+	*p++ = '\n';
+	assert(p - buf <= FRAME_MAX);
+	return p - buf;
+}
+
+/* Write the line between two rows of the board at p, and return its end. */
+char *frame_rule(char *p)
+{
+	int i;
+
+	for (i = 0; i < BOARD_N; i++) {
+		memcpy(p, "+---", 4);
+		p += 4;
+	}
+	*p++ = '+';
+	*p++ = '\n';
+	return p;
 }